@@ -0,0 +1,300 @@
+/*
+ * Binary protocol - COBS framed commands, an alternative to the text interpreter
+ * for machine hosts.
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "binary-protocol.h"
+#include "interpreter.h"
+#include "serial-out.h"
+#include "settings.h"
+#include <Arduino.h>
+
+/***
+ * The binary protocol trades human readability for fewer bytes on the wire
+ * and no number parsing on the robot. Frames are encoded with Consistent
+ * Overhead Byte Stuffing (COBS) so that a zero byte never appears inside a
+ * frame and can be used to mark the end of each one. A host that loses sync
+ * only has to send a zero byte to start afresh.
+ *
+ * Binary mode is entered with the text command 'B1' and left again with a
+ * binary 'B' frame whose sub-command is '0'.
+ */
+
+static bool binary_mode = false;
+static bool binary_command = false;
+
+static uint8_t rx_buffer[BINARY_FRAME_SIZE];
+static uint8_t rx_length = 0;
+static bool rx_overflow = false;
+
+static const uint8_t *arguments;
+static uint8_t argument_length;
+
+static uint8_t reply[BINARY_REPLY_SIZE];
+static uint8_t reply_length;
+
+// Only commands whose replies are shorter in binary can be sent this way, and
+// B to get back to text. Every binary command gets a reply frame, so those
+// that are silent in text with V0 ('p' and the like) take more bytes as
+// frames, and so do the short text replies of 'b' and of 'C' until the
+// encoder totals reach six digits. The rest would print text into the stream.
+static const char binary_commands[] PROGMEM = "BSUg";
+
+void enter_binary_mode()
+{
+    binary_mode = true;
+    rx_length = 0;
+    rx_overflow = false;
+}
+
+void leave_binary_mode()
+{
+    binary_mode = false;
+}
+
+bool binary_mode_enabled()
+{
+    return binary_mode;
+}
+
+bool binary_command_active()
+{
+    return binary_command;
+}
+
+/***
+ * Encoded output is always one byte longer than the input. There is no
+ * special handling of 254 byte blocks because frames are much shorter.
+ */
+uint8_t cobs_encode(const uint8_t *data, uint8_t length, uint8_t *encoded)
+{
+    uint8_t out = 0;
+    uint8_t start = 0;
+    for (uint8_t i = 0; i <= length; i++)
+    {
+        if (i == length or data[i] == 0)
+        {
+            encoded[out++] = i - start + 1;
+            while (start < i)
+            {
+                encoded[out++] = data[start++];
+            }
+            start = i + 1;
+        }
+    }
+    return out;
+}
+
+/***
+ * Decodes in place since the output never overtakes the input.
+ * Returns the decoded length or zero if the frame is malformed.
+ */
+uint8_t cobs_decode(uint8_t *buffer, uint8_t length)
+{
+    uint8_t read = 0;
+    uint8_t write = 0;
+    while (read < length)
+    {
+        uint8_t code = buffer[read++];
+        if (code == 0 or read + code - 1 > length)
+        {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; i++)
+        {
+            buffer[write++] = buffer[read++];
+        }
+        if (code != 0xFF and read < length)
+        {
+            buffer[write++] = 0;
+        }
+    }
+    return write;
+}
+
+/***
+ * Appends the crc to the frame (so there must be room for it) then encodes
+ * the whole thing, including the zero terminator, ready to send.
+ * The encoded buffer needs to be at least length + 3 bytes.
+ */
+uint8_t binary_encode_frame(uint8_t *frame, uint8_t length, uint8_t *encoded)
+{
+    frame[length] = crc8(frame, length);
+    uint8_t encoded_length = cobs_encode(frame, length + 1, encoded);
+    encoded[encoded_length++] = 0;
+    return encoded_length;
+}
+
+static void send_reply(uint8_t opcode, int8_t status)
+{
+    uint8_t encoded[BINARY_REPLY_SIZE + 2];
+    reply[0] = opcode;
+    reply[1] = status;
+    uint8_t length = binary_encode_frame(reply, reply_length, encoded);
+    tx.write_frame(encoded, length);
+}
+
+static void add_to_reply(const void *data, uint8_t size)
+{
+    // always leave room for the crc
+    if (reply_length + size < BINARY_REPLY_SIZE)
+    {
+        memcpy(reply + reply_length, data, size);
+        reply_length += size;
+    }
+}
+
+void binary_reply_int16(int16_t value)
+{
+    add_to_reply(&value, sizeof(value));
+}
+
+void binary_reply_int32(int32_t value)
+{
+    add_to_reply(&value, sizeof(value));
+}
+
+void binary_reply_float(float value)
+{
+    add_to_reply(&value, sizeof(value));
+}
+
+/***
+ * The AVR is little-endian so arguments can be copied straight out of the
+ * frame. int16 arguments suit whole numbers (mm, mm/s, degrees) and halve the
+ * number of bytes sent. The handler asks for a fixed count so the length of
+ * the argument block tells us which size was used.
+ */
+int8_t binary_float_arguments(float *args, uint8_t count)
+{
+    if (argument_length == count * sizeof(float))
+    {
+        memcpy(args, arguments, argument_length);
+    }
+    else if (argument_length == count * sizeof(int16_t))
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            int16_t value;
+            memcpy(&value, arguments + i * sizeof(int16_t), sizeof(value));
+            args[i] = value;
+        }
+    }
+    else
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    return T_OK;
+}
+
+static void execute_frame(uint8_t length)
+{
+    reply_length = 2;
+    uint8_t opcode = length ? rx_buffer[0] : 0;
+    if (length < 2 or crc8(rx_buffer, length - 1) != rx_buffer[length - 1])
+    {
+        send_reply(opcode, T_BAD_FRAME);
+        return;
+    }
+    length--; // drop the crc
+    if (opcode == 0 or strchr_P(binary_commands, opcode) == 0)
+    {
+        send_reply(opcode, T_UNKNOWN_COMMAND);
+        return;
+    }
+
+    // the handlers look for their sub-command in the input line as usual.
+    // Arguments come in whole int16s or floats, so an odd number of bytes
+    // after the opcode means the first of them is a sub-command.
+    uint8_t first_argument = ((length - 1) & 1) ? 2 : 1;
+    inputString[0] = opcode;
+    inputString[1] = (first_argument == 2) ? rx_buffer[1] : 0;
+    inputString[2] = 0;
+    inputIndex = 0;
+    arguments = rx_buffer + first_argument;
+    argument_length = length - first_argument;
+
+    binary_command = true;
+    int8_t status = execute_command();
+    binary_command = false;
+
+    if (status == T_SILENT_ERROR)
+    {
+        status = T_OK;
+    }
+    send_reply(opcode, status);
+}
+
+/** @brief  Binary counterpart of interpreter(). Called from the same place.
+ *  @return Void.
+ */
+void binary_interpreter()
+{
+    uint32_t start_time = micros();
+    while (Serial.available())
+    {
+        uint8_t c = Serial.read();
+        if (c != 0)
+        {
+            if (rx_length < BINARY_FRAME_SIZE)
+            {
+                rx_buffer[rx_length++] = c;
+            }
+            else
+            {
+                rx_overflow = true;
+            }
+            continue;
+        }
+
+        // a zero byte marks the end of the frame
+        if (rx_overflow)
+        {
+            reply_length = 2;
+            send_reply(0, T_LINE_TOO_LONG);
+        }
+        else if (rx_length > 1)
+        {
+            // a lone byte cannot be a frame - most likely a stray CR or LF
+            // left over from the 'B1' line, so it is dropped silently.
+            execute_frame(cobs_decode(rx_buffer, rx_length));
+        }
+        rx_length = 0;
+        rx_overflow = false;
+        // same limits as the text interpreter
+        if (not binary_mode_enabled() or not interpreter_may_continue(start_time))
+        {
+            break;
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Binary protocol - COBS framed commands, an alternative to the text interpreter
+ * for machine hosts.
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef BINARY_PROTOCOL_H_
+#define BINARY_PROTOCOL_H_
+
+#include <stdint.h>
+
+/***
+ * Frame layout (before COBS encoding)
+ *
+ * Command:  opcode, [sub-command], [arguments ...], crc8
+ * Reply:    opcode, status, [payload ...], crc8
+ *
+ * The opcode is the same character as the text command and is dispatched
+ * through the same handler table. Arguments are packed little-endian and are
+ * either all int16 or all float32 - the handler tells which from the length.
+ * As arguments always take an even number of bytes, the sub-command is
+ * there when an odd number of bytes follows the opcode.
+ * Each encoded frame is terminated by a single zero byte.
+ */
+#define BINARY_FRAME_SIZE 24
+// replies can be longer than commands. 'g' needs 49 bytes.
+#define BINARY_REPLY_SIZE 56
+
+void binary_interpreter();
+
+void enter_binary_mode();
+void leave_binary_mode();
+bool binary_mode_enabled();
+
+// true while a command received in a binary frame is being executed
+bool binary_command_active();
+int8_t binary_float_arguments(float *args, uint8_t count);
+
+// reply payload, sent after the status byte when the command finishes
+void binary_reply_int16(int16_t value);
+void binary_reply_int32(int32_t value);
+void binary_reply_float(float value);
+
+uint8_t binary_encode_frame(uint8_t *frame, uint8_t length, uint8_t *encoded);
+uint8_t cobs_encode(const uint8_t *data, uint8_t length, uint8_t *encoded);
+uint8_t cobs_decode(uint8_t *buffer, uint8_t length);
+
+#endif /* BINARY_PROTOCOL_H_ */
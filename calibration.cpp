@@ -0,0 +1,326 @@
+/*
+ * Calibration. Routines the robot runs on itself to measure its own constants.
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include "calibration.h"
+#include "distance-moved.h"
+#include "interpreter.h"
+#include "motion-queue.h"
+#include "motors.h"
+#include "profile.h"
+#include "serial-out.h"
+#include "settings.h"
+#include "stopwatch.h"
+#include "switches.h"
+#include "write-number.h"
+
+// the voltage steps, in each direction
+const float FF_FIRST_VOLTS = 1.0f;
+const float FF_VOLTS_STEP = 0.5f;
+const uint8_t FF_STEPS = 7;
+// how long each step is given to settle, then measured for
+const uint32_t FF_SETTLE_TIME = 500 * ONE_MILLISECOND;
+const uint32_t FF_MEASURE_TIME = 800 * ONE_MILLISECOND;
+// slower than this and the wheel is probably stuck in its static friction
+const float FF_MIN_SPEED = 20.0f;
+
+/***
+ * Straight line least squares fit of volts against speed. Sums are kept
+ * rather than the points so it costs the same whatever the number of steps.
+ */
+struct LineFit
+{
+    uint8_t n = 0;
+    float sx = 0;
+    float sy = 0;
+    float sxx = 0;
+    float sxy = 0;
+
+    void add(float x, float y)
+    {
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    // fills in the slope and intercept. False if there is nothing to fit
+    bool solve(float &slope, float &intercept) const
+    {
+        float d = n * sxx - sx * sx;
+        if (n < 2 or d <= 0)
+        {
+            return false;
+        }
+        slope = (n * sxy - sx * sy) / d;
+        intercept = (sy - slope * sx) / n;
+        return slope > 0;
+    }
+};
+
+// relay tests, see autotune()
+const float RELAY_VOLTS = 1.5f;
+const float RELAY_FWD_HYSTERESIS = 0.2f; // mm
+const float RELAY_ROT_HYSTERESIS = 0.5f; // degrees
+const uint8_t RELAY_CYCLES = 8;
+const uint32_t RELAY_TIME_LIMIT = 5 * ONE_SECOND;
+
+/***
+ * True if the button is pressed or an 'x' (or ctrl-X) is waiting. It is
+ * left for the interpreter, which will stop everything once the test has
+ * returned.
+ */
+static bool abandoned()
+{
+    int c = Serial.peek();
+    return button_pressed() or c == 'x' or c == 0x18;
+}
+
+// false if the test has been abandoned
+static bool wait_for(uint32_t time)
+{
+    Stopwatch sw;
+    while (sw.split() < time)
+    {
+        serial_out_service();
+        if (abandoned())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// false if the test has been abandoned, in which case left and right are not set
+static bool wheel_speeds(float &left, float &right)
+{
+    float left_start;
+    float right_start;
+    wheel_distances(left_start, right_start);
+    Stopwatch sw;
+    if (not wait_for(FF_MEASURE_TIME))
+    {
+        return false;
+    }
+    float seconds = sw.split() * 1.0e-6f;
+    wheel_distances(left, right);
+    left = (left - left_start) / seconds;
+    right = (right - right_start) / seconds;
+    return true;
+}
+
+static void print_fit(const __FlashStringHelper *wheel, float bias, float speed_ff)
+{
+    tx.print(wheel);
+    tx.print(F(" bias "));
+    print_float(tx, bias, 4);
+    tx.print(F(" speedFF "));
+    print_float(tx, speed_ff, 6);
+    tx.println();
+}
+
+/***
+ * The wheels turn in opposite directions so that the robot spins on the
+ * spot and needs no more room than it takes up. Each voltage is used both
+ * ways round, and the bias is taken to be the same both ways, so the fit
+ * is of the volts against the size of the speed.
+ */
+int8_t characterise_feedforward()
+{
+    forward_queue.clear();
+    rotation_queue.clear();
+    forward.reset();
+    rotation.reset();
+    disable_motor_controllers();
+    reset_motor_controllers();
+    LineFit left_fit;
+    LineFit right_fit;
+    bool stopped = false;
+    for (uint8_t i = 0; i < FF_STEPS and not stopped; i++)
+    {
+        float volts = FF_FIRST_VOLTS + i * FF_VOLTS_STEP;
+        for (int8_t direction = 1; direction >= -1 and not stopped; direction -= 2)
+        {
+            set_left_motor_volts(direction * volts);
+            set_right_motor_volts(-direction * volts);
+            float left;
+            float right;
+            if (not wait_for(FF_SETTLE_TIME) or not wheel_speeds(left, right))
+            {
+                stopped = true;
+                break;
+            }
+            if (fabsf(left) > FF_MIN_SPEED)
+            {
+                left_fit.add(fabsf(left), volts);
+            }
+            if (fabsf(right) > FF_MIN_SPEED)
+            {
+                right_fit.add(fabsf(right), volts);
+            }
+            print_float(tx, direction * volts, 2);
+            tx.print(' ');
+            print_float(tx, left, 1);
+            tx.print(' ');
+            print_float(tx, right, 1);
+            tx.println();
+        }
+    }
+    stop_motors();
+    if (stopped)
+    {
+        return T_OK;
+    }
+    float left_speed_ff;
+    float left_bias;
+    float right_speed_ff;
+    float right_bias;
+    if (not left_fit.solve(left_speed_ff, left_bias) or not right_fit.solve(right_speed_ff, right_bias))
+    {
+        return T_OUT_OF_RANGE;
+    }
+    // a wheel that only just turns can make the line cross below zero
+    settings.leftBiasFF = max(left_bias, 0.0f);
+    settings.leftSpeedFF = left_speed_ff;
+    settings.rightBiasFF = max(right_bias, 0.0f);
+    settings.rightSpeedFF = right_speed_ff;
+    update_controller_gains();
+    print_fit(F("left"), settings.leftBiasFF, left_speed_ff);
+    print_fit(F("right"), settings.rightBiasFF, right_speed_ff);
+    return T_OK;
+}
+
+/***
+ * Relay feedback (Astrom-Hagglund). A relay of +/- d volts in place of the
+ * controller makes the axis oscillate about its target with the period
+ * Tu at which the loop has 180 degrees of phase lag. For an error of
+ * amplitude a, with hysteresis h, the ultimate gain is
+ *    Ku = 4d / (pi.sqrt(a^2 - h^2))
+ * The gains are the Ziegler-Nichols 'no overshoot' PID rule
+ *    Kp = 0.2Ku, Ti = Tu/2, Td = Tu/3
+ * which is gentle enough to use straight away and tighten by hand.
+ * KI is Kp/Ti. The D term works on the change in error per tick at
+ * LOOP_FREQUENCY, so KD = Kp.Td.LOOP_FREQUENCY.
+ */
+int8_t autotune(uint8_t axis)
+{
+    forward_queue.clear();
+    rotation_queue.clear();
+    forward.reset();
+    rotation.reset();
+    reset_motor_controllers();
+    float hysteresis = (axis == RELAY_FORWARD) ? RELAY_FWD_HYSTERESIS : RELAY_ROT_HYSTERESIS;
+    start_relay_test(axis, RELAY_VOLTS, hysteresis);
+    enable_motor_controllers();
+    float amplitude;
+    float period;
+    bool stopped = false;
+    Stopwatch sw;
+    while (relay_test_result(amplitude, period) < RELAY_CYCLES and sw.split() < RELAY_TIME_LIMIT)
+    {
+        if (not wait_for(10 * ONE_MILLISECOND))
+        {
+            stopped = true;
+            break;
+        }
+    }
+    uint8_t cycles = relay_test_result(amplitude, period);
+    disable_motor_controllers();
+    stop_relay_test();
+    stop_motors();
+    reset_motor_controllers();
+    if (stopped)
+    {
+        return T_OK;
+    }
+    if (cycles == 0 or amplitude <= hysteresis)
+    {
+        return T_OUT_OF_RANGE;
+    }
+    float ku = 4 * RELAY_VOLTS / (PI * sqrtf(amplitude * amplitude - hysteresis * hysteresis));
+    float kp = 0.2f * ku;
+    float ki = kp / (0.5f * period);
+    float kd = kp * (period / 3) * LOOP_FREQUENCY;
+    if (axis == RELAY_FORWARD)
+    {
+        settings.fwdKP = kp;
+        settings.fwdKI = ki;
+        settings.fwdKD = kd;
+    }
+    else
+    {
+        settings.rotKP = kp;
+        settings.rotKI = ki;
+        settings.rotKD = kd;
+    }
+    update_controller_gains();
+    print_unsigned(tx, cycles);
+    tx.print(F(" cycles Ku "));
+    print_float(tx, ku, 4);
+    tx.print(F(" Tu "));
+    print_float(tx, period, 4);
+    tx.print(F(" KP "));
+    print_float(tx, kp, 4);
+    tx.print(F(" KI "));
+    print_float(tx, ki, 4);
+    tx.print(F(" KD "));
+    print_float(tx, kd, 4);
+    tx.println();
+    return T_OK;
+}
+
+/** @brief  K commands make the robot measure its own constants.
+ *          Kf - fit the feedforward settings
+ *          Kp - autotune the position (forward) controller
+ *          Kr - autotune the rotation controller
+ *  @return error code
+ */
+int8_t calibration_command()
+{
+    char c = inputString[1];
+    if (c == 'f')
+    {
+        return characterise_feedforward();
+    }
+    if (c == 'p')
+    {
+        return autotune(RELAY_FORWARD);
+    }
+    if (c == 'r')
+    {
+        return autotune(RELAY_ROTATION);
+    }
+    return T_UNEXPECTED_TOKEN;
+}
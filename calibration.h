@@ -0,0 +1,65 @@
+/*
+ * Calibration. Routines the robot runs on itself to measure its own constants.
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <Arduino.h>
+
+/***
+ * Steps the motors through a set of voltages with the robot spinning on
+ * the spot, measures the steady speed of each wheel and fits the bias and
+ * speed feedforward settings for each wheel by least squares. The results
+ * go into the working settings, ready to be stored with '$!'.
+ *
+ * Takes about 20 seconds. The button or an 'x' stops it early, leaving
+ * the settings alone. The motor controllers are left disabled.
+ * @return T_OK, or T_OUT_OF_RANGE if the wheels did not turn enough to fit
+ */
+int8_t characterise_feedforward();
+
+/***
+ * Runs a relay feedback test on one axis, RELAY_FORWARD or RELAY_ROTATION
+ * from motors.h, and writes the KP, KI and KD settings for that axis from
+ * the ultimate gain and period it measures. Stops after 8 cycles or 5
+ * seconds, or when the button is pressed or an 'x' arrives. The motor
+ * controllers are left disabled.
+ * @return T_OK, or T_OUT_OF_RANGE if the axis did not oscillate
+ */
+int8_t autotune(uint8_t axis);
+
+int8_t calibration_command();
+
+#endif /* CALIBRATION_H_ */
@@ -0,0 +1,100 @@
+/*
+ * Control state - the systick's results published for loop() without masking interrupts
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include "control-state.h"
+#include "distance-moved.h"
+#include "profile.h"
+#include "sensors_control.h"
+
+static ControlState s_states[2];
+static volatile uint8_t s_version = 0; // s_states[s_version & 1] is current
+static uint16_t s_retries = 0;
+
+// stop the compiler moving the copy across the version reads and writes
+#define COMPILER_BARRIER() asm volatile("" ::: "memory")
+
+void publish_control_state()
+{
+    uint8_t next = s_version + 1;
+    ControlState &state = s_states[next & 1];
+    state.robot_position = robot_position_isr();
+    state.robot_angle = robot_angle_isr();
+    state.robot_fwd_increment = robot_fwd_increment_isr();
+    state.robot_rot_increment = robot_rot_increment_isr();
+    state.forward_position = forward.position_isr();
+    state.forward_speed = forward.speed_isr();
+    state.rotation_position = rotation.position_isr();
+    state.rotation_speed = rotation.speed_isr();
+    state.left_total = encoder_left_total_isr();
+    state.right_total = encoder_right_total_isr();
+    // the last sensor cycle finished before this tick started
+    state.sensors_dark[0] = gSensorA0_dark;
+    state.sensors_dark[1] = gSensorA1_dark;
+    state.sensors_dark[2] = gSensorA2_dark;
+    state.sensors_dark[3] = gSensorA3_dark;
+    state.sensors_dark[4] = gSensorA4_dark;
+    state.sensors_dark[5] = gSensorA5_dark;
+    state.sensors_lit[0] = gSensorA0_light;
+    state.sensors_lit[1] = gSensorA1_light;
+    state.sensors_lit[2] = gSensorA2_light;
+    state.sensors_lit[3] = gSensorA3_light;
+    state.sensors_lit[4] = gSensorA4_light;
+    state.sensors_lit[5] = gSensorA5_light;
+    COMPILER_BARRIER();
+    s_version = next;
+}
+
+void read_control_state(ControlState &state)
+{
+    uint8_t version = s_version;
+    while (true)
+    {
+        COMPILER_BARRIER();
+        state = s_states[version & 1];
+        COMPILER_BARRIER();
+        uint8_t latest = s_version;
+        if (latest == version)
+        {
+            return;
+        }
+        version = latest;
+        s_retries++;
+    }
+}
+
+uint16_t control_state_retries()
+{
+    return s_retries;
+}
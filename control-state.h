@@ -0,0 +1,86 @@
+/*
+ * Control state - the systick's results published for loop() without masking interrupts
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#ifndef CONTROL_STATE_H_
+#define CONTROL_STATE_H_
+
+#include "fixed-point.h"
+#include <stdint.h>
+
+/***
+ * Once per tick, after the controllers have run, the systick copies the
+ * values that loop() wants to read into a ControlState. There are two of
+ * them. The systick fills the one that is not current and then bumps a
+ * version number to make it current, so a reader can copy the current one
+ * while the next is being written. If the version changed while it was
+ * copying, the systick has written twice and the reader just tries again.
+ *
+ * The version number is the generation count. Readers never disable
+ * interrupts, so they add nothing to the latency of the encoder interrupts.
+ * The values are at most one tick old and all come from the same tick, so
+ * the 32 bit encoder totals can never be seen half updated and the two
+ * wheels always agree with each other and with the robot position.
+ *
+ * Code running in the systick should use the _isr accessors in
+ * distance-moved.h and profile.h instead. They read the live values with
+ * no atomic wrapper, which is safe because nothing else writes them while
+ * the systick runs.
+ */
+struct ControlState
+{
+    real_t robot_position;
+    real_t robot_angle;
+    real_t robot_fwd_increment;
+    real_t robot_rot_increment;
+    real_t forward_position;
+    real_t forward_speed;
+    real_t rotation_position;
+    real_t rotation_speed;
+    int32_t left_total;
+    int32_t right_total;
+    int sensors_dark[6];
+    int sensors_lit[6];
+};
+
+// systick only, once per tick
+void publish_control_state();
+
+// loop() only. Copies the latest complete state.
+void read_control_state(ControlState &state);
+
+// how many times read_control_state() has had to start again
+uint16_t control_state_retries();
+
+#endif /* CONTROL_STATE_H_ */
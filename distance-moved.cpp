@@ -38,7 +38,11 @@
 #include "robot_config.h"
 #include "stopwatch.h"
 #include "distance-moved.h"
+#include "systick.h"
+#include "control-state.h"
 #include "interpreter.h"
+#include "serial-out.h"
+#include "write-number.h"
 #include <Arduino.h>
 #include <util/atomic.h>
 
@@ -101,15 +105,15 @@ const float MM_PER_COUNT = (PI * WHEEL_DIAMETER) / (2 * ENCODER_PULSES_PER_ROTAT
 const float DEG_PER_COUNT = (360.0 * MM_PER_COUNT) / (PI * WHEEL_SEPARATION);
 
 // These are the constants use in calculations
-const float MM_PER_COUNT_LEFT = (1 - ROTATION_BIAS) * PI * WHEEL_DIAMETER / (ENCODER_PULSES_PER_ROTATION * GEAR_RATIO);
-const float MM_PER_COUNT_RIGHT = (1 + ROTATION_BIAS) * PI * WHEEL_DIAMETER / (ENCODER_PULSES_PER_ROTATION * GEAR_RATIO);
-const float DEG_PER_MM_DIFFERENCE = (180.0 / (2 * MOUSE_RADIUS * PI));
+const real_t MM_PER_COUNT_LEFT = (1 - ROTATION_BIAS) * PI * WHEEL_DIAMETER / (ENCODER_PULSES_PER_ROTATION * GEAR_RATIO);
+const real_t MM_PER_COUNT_RIGHT = (1 + ROTATION_BIAS) * PI * WHEEL_DIAMETER / (ENCODER_PULSES_PER_ROTATION * GEAR_RATIO);
+const real_t DEG_PER_MM_DIFFERENCE = (180.0 / (2 * MOUSE_RADIUS * PI));
 
-static volatile float s_robot_position;
-static volatile float s_robot_angle;
+static volatile real_t s_robot_position;
+static volatile real_t s_robot_angle;
 
-static float s_robot_fwd_increment = 0;
-static float s_robot_rot_increment = 0;
+static real_t s_robot_fwd_increment = 0;
+static real_t s_robot_rot_increment = 0;
 
 int encoder_left_counter;
 int encoder_right_counter;
@@ -135,6 +139,25 @@ void reset_encoders()
     }
 }
 
+void take_encoder_totals(int32_t &left, int32_t &right)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        left = s_left_total + encoder_left_counter;
+        right = s_right_total + encoder_right_counter;
+        reset_encoders();
+    }
+}
+
+void inject_encoder_counts(int left, int right)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        encoder_left_counter += left;
+        encoder_right_counter += right;
+    }
+}
+
 void setup_encoders()
 {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
@@ -175,51 +198,88 @@ void update_encoders()
     }
     s_left_total += left_delta;
     s_right_total += right_delta;
-    float left_change = left_delta * MM_PER_COUNT_LEFT;
-    float right_change = right_delta * MM_PER_COUNT_RIGHT;
-    s_robot_fwd_increment = 0.5 * (right_change + left_change);
+    real_t left_change = left_delta * MM_PER_COUNT_LEFT;
+    real_t right_change = right_delta * MM_PER_COUNT_RIGHT;
+    s_robot_fwd_increment = real_t(0.5f) * (right_change + left_change);
     s_robot_rot_increment = (right_change - left_change) * DEG_PER_MM_DIFFERENCE;
     s_robot_position += s_robot_fwd_increment;
     s_robot_angle += s_robot_rot_increment;
 }
 
-float robot_position()
+real_t robot_position_isr()
+{
+    return s_robot_position;
+}
+
+real_t robot_angle_isr()
+{
+    return s_robot_angle;
+}
+
+real_t robot_fwd_increment_isr()
 {
-    float distance;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { distance = s_robot_position; }
-    return distance;
+    return s_robot_fwd_increment;
 }
 
-float robot_fwd_increment()
+real_t robot_rot_increment_isr()
 {
-    float distance;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { distance = s_robot_fwd_increment; }
-    return distance;
+    return s_robot_rot_increment;
 }
 
-float robot_rot_increment()
+float robot_position()
 {
-    float distance;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { distance = s_robot_rot_increment; }
-    return distance;
+    ControlState state;
+    read_control_state(state);
+    return to_float(state.robot_position);
 }
 
 float robot_angle()
 {
-    float angle;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { angle = s_robot_angle; }
-    return angle;
+    ControlState state;
+    read_control_state(state);
+    return to_float(state.robot_angle);
 }
 
-uint32_t encoder_left_total()
+void wheel_distances(float &left, float &right)
+{
+    int32_t left_total;
+    int32_t right_total;
+    encoder_totals(left_total, right_total);
+    left = left_total * to_float(MM_PER_COUNT_LEFT);
+    right = right_total * to_float(MM_PER_COUNT_RIGHT);
+}
+
+int32_t encoder_left_total_isr()
 {
     return s_left_total;
-};
+}
 
-uint32_t encoder_right_total()
+int32_t encoder_right_total_isr()
 {
     return s_right_total;
-};
+}
+
+uint32_t encoder_left_total()
+{
+    ControlState state;
+    read_control_state(state);
+    return state.left_total;
+}
+
+uint32_t encoder_right_total()
+{
+    ControlState state;
+    read_control_state(state);
+    return state.right_total;
+}
+
+void encoder_totals(int32_t &left, int32_t &right)
+{
+    ControlState state;
+    read_control_state(state);
+    left = state.left_total;
+    right = state.right_total;
+}
 
 // Interrupt called every time there is a change on the left encoder.
 // INT0 will respond to the XOR-ed pulse train from the left encoder
@@ -260,9 +320,10 @@ int8_t print_encoder_setup()
 {
     const char comma = ',';
 
-    Serial.print(MM_PER_COUNT, 5);
-    Serial.print(comma);
-    Serial.println(DEG_PER_COUNT, 5);
+    print_float(tx, MM_PER_COUNT, 5);
+    tx.print(comma);
+    print_float(tx, DEG_PER_COUNT, 5);
+    tx.println();
     return T_OK;
 }
 
@@ -278,43 +339,46 @@ bool print_encoders(char select)
 {
     const char comma = ',';
 
+    // one copy of the published state so the totals, position and angle all agree
+    ControlState state;
+    read_control_state(state);
     if (select == 'a' or select == 0)
     {
         // the encoder sum is a measure of forward travel
-        Serial.print(s_right_total + s_left_total);
-        Serial.print(comma);
-        Serial.print(s_robot_position);
-        Serial.print(comma);
-        Serial.print(s_right_total - s_left_total);
-        Serial.print(comma);
-        Serial.println(s_robot_angle);
+        print_integer(tx, state.right_total + state.left_total);
+        tx.print(comma);
+        print_float(tx, to_float(state.robot_position));
+        tx.print(comma);
+        print_integer(tx, state.right_total - state.left_total);
+        tx.print(comma);
+        print_float(tx, to_float(state.robot_angle));
+        tx.println();
     }
     else if (select == 'r')
     {
-        Serial.print(s_right_total + s_left_total);
-        Serial.print(comma);
-        Serial.println(s_right_total - s_left_total);
+        print_integer(tx, state.right_total + state.left_total);
+        tx.print(comma);
+        print_integer(tx, state.right_total - state.left_total);
+        tx.println();
     }
     else if (select == 'u')
     {
-        Serial.print(s_robot_position);
-        Serial.print(comma);
-        Serial.println(s_robot_angle);
+        print_float(tx, to_float(state.robot_position));
+        tx.print(comma);
+        print_float(tx, to_float(state.robot_angle));
+        tx.println();
     }
     else if (select == 's')
     {
-        int fwd, rot;
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-        {
-            fwd = s_robot_fwd_increment;
-            rot = s_robot_rot_increment;
-        }
-        float robot_velocity = LOOP_FREQUENCY * fwd;
-        float robot_omega = LOOP_FREQUENCY * rot;
-
-        Serial.print(robot_velocity);
-        Serial.print(comma);
-        Serial.println(robot_omega);
+        int fwd = to_int(state.robot_fwd_increment);
+        int rot = to_int(state.robot_rot_increment);
+        float robot_velocity = g_loop_frequency * fwd;
+        float robot_omega = g_loop_frequency * rot;
+
+        print_float(tx, robot_velocity);
+        tx.print(comma);
+        print_float(tx, robot_omega);
+        tx.println();
     }
     else
     {
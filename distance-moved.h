@@ -36,20 +36,35 @@
 #ifndef DISTANCE_MOVED_H_
 #define DISTANCE_MOVED_H_
 
+#include "fixed-point.h"
 #include <stdint.h>
 
+// from the published control state, so at most one tick old
 uint32_t encoder_left_total();
 uint32_t encoder_right_total();
+void encoder_totals(int32_t &left, int32_t &right); // both from the same tick
 
 void reset_encoders();
+// the exact totals, including counts the systick has not seen yet, then zero
+void take_encoder_totals(int32_t &left, int32_t &right);
+// add counts as if the wheels had turned - for the q5 stress test
+void inject_encoder_counts(int left, int right);
 void setup_encoders();
 void update_encoders();
 
-float robot_fwd_increment();
-float robot_rot_increment();
+// systick only - see control-state.h
+real_t robot_fwd_increment_isr();
+real_t robot_rot_increment_isr();
+real_t robot_position_isr();
+real_t robot_angle_isr();
+int32_t encoder_left_total_isr();
+int32_t encoder_right_total_isr();
 
+// from the published control state, so at most one tick old
 float robot_position();
 float robot_angle();
+// how far each wheel has turned in mm, from the published encoder totals
+void wheel_distances(float &left, float &right);
 
 int8_t print_encoder_setup();
 bool print_encoders(char select);
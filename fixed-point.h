@@ -0,0 +1,279 @@
+/*
+ * Fixed point - Q16.16 numbers for the control loop
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#ifndef FIXED_POINT_H_
+#define FIXED_POINT_H_
+
+#include "robot_config.h"
+#include "misc_definitions.h"
+#include <stdint.h>
+
+/***
+ * The ATmega328P has no floating point hardware so every float add or
+ * multiply in the systick control chain is a library call costing
+ * somewhere between 80 and 150 cycles. A Q16.16 number holds the same
+ * values in an int32_t with a 16 bit integer part and a 16 bit fraction
+ * so that add, subtract and compare are single 32 bit operations and a
+ * multiply is four 16x16 bit hardware multiplies.
+ *
+ * Range is -32768 to +32767.99998 with a resolution of 1/65536 (1.5e-5).
+ * That covers the control loop comfortably - positions in mm, angles in
+ * degrees, speeds in mm/s or deg/s and volts - but it does mean a fixed
+ * point build will wrap after 32.7m of travel or 91 turns on the spot.
+ * Nothing saturates except where noted, just like int arithmetic.
+ *
+ * CONTROL_FIXED_POINT in misc_definitions.h selects which of float or Fixed
+ * the control chain uses as its real_t. Code written in terms of real_t,
+ * fraction_t, to_float(), to_int() and fabsf() compiles either way.
+ */
+class Fixed
+{
+public:
+    constexpr Fixed() : m_raw(0) {}
+
+    // Rounds to the nearest 1/65536. Use constants or convert outside the
+    // ISR where possible because this is a float multiply.
+    constexpr Fixed(float value)
+        : m_raw((int32_t)(value * 65536.0f + (value < 0 ? -0.5f : 0.5f))) {}
+
+    constexpr Fixed(const Fixed &other) = default;
+    Fixed(const volatile Fixed &other) : m_raw(other.m_raw) {}
+
+    Fixed &operator=(const Fixed &other) = default;
+    Fixed &operator=(const volatile Fixed &other)
+    {
+        m_raw = other.m_raw;
+        return *this;
+    }
+    void operator=(const Fixed &other) volatile { m_raw = other.m_raw; }
+
+    static constexpr Fixed from_raw(int32_t raw)
+    {
+        return Fixed(raw, 0);
+    }
+
+    constexpr int32_t raw() const
+    {
+        return m_raw;
+    }
+
+    float to_float() const
+    {
+        return m_raw * (1.0f / 65536.0f);
+    }
+
+    // truncates towards zero like a cast from float
+    int to_int() const
+    {
+        return m_raw < 0 ? -(int)(-m_raw >> 16) : (int)(m_raw >> 16);
+    }
+
+    Fixed operator-() const
+    {
+        return from_raw(-m_raw);
+    }
+
+    Fixed &operator+=(Fixed other)
+    {
+        m_raw += other.m_raw;
+        return *this;
+    }
+
+    Fixed &operator-=(Fixed other)
+    {
+        m_raw -= other.m_raw;
+        return *this;
+    }
+
+    void operator+=(Fixed other) volatile
+    {
+        m_raw += other.m_raw;
+    }
+
+    void operator-=(Fixed other) volatile
+    {
+        m_raw -= other.m_raw;
+    }
+
+    /***
+     * (a * b) >> 16 without a 64 bit product, which avr-gcc builds out of
+     * a slow generic routine. Each operand is split into a signed high half
+     * and an unsigned low half so that only 16x16->32 bit multiplies are
+     * needed and the compiler can use the MUL/MULS/MULSU instructions.
+     * The result is the same as the 64 bit version, rounded down.
+     */
+    static int32_t multiply(int32_t a, int32_t b)
+    {
+        int16_t ah = a >> 16;
+        uint16_t al = a;
+        int16_t bh = b >> 16;
+        uint16_t bl = b;
+        uint32_t high = ((uint32_t)(uint16_t)ah * (uint16_t)bh) << 16;
+        uint32_t middle = (uint32_t)((int32_t)ah * bl) + (uint32_t)((int32_t)bh * al);
+        uint32_t low = ((uint32_t)al * bl) >> 16;
+        return (int32_t)(high + middle + low);
+    }
+
+private:
+    constexpr Fixed(int32_t raw, int) : m_raw(raw) {}
+
+    int32_t m_raw;
+};
+
+/***
+ * An unsigned fraction in the range [0, 1) held as Q0.32. Used for the
+ * small constants like the loop interval where a Q16.16 value would only
+ * have a few significant bits: 0.002 is just 131/65536.
+ */
+class Fraction
+{
+public:
+    constexpr Fraction(float value)
+        : m_raw(value >= 1.0f ? 0xFFFFFFFFUL : (uint32_t)(value * 4294967296.0f + 0.5f)) {}
+
+    constexpr uint32_t raw() const
+    {
+        return m_raw;
+    }
+
+private:
+    uint32_t m_raw;
+};
+
+inline Fixed operator+(Fixed a, Fixed b)
+{
+    return Fixed::from_raw(a.raw() + b.raw());
+}
+
+inline Fixed operator-(Fixed a, Fixed b)
+{
+    return Fixed::from_raw(a.raw() - b.raw());
+}
+
+inline Fixed operator*(Fixed a, Fixed b)
+{
+    return Fixed::from_raw(Fixed::multiply(a.raw(), b.raw()));
+}
+
+inline Fixed operator*(Fixed a, int b)
+{
+    return Fixed::from_raw(a.raw() * (int32_t)b);
+}
+
+inline Fixed operator*(int a, Fixed b)
+{
+    return b * a;
+}
+
+/***
+ * Truncates towards zero so that positive and negative values see the same
+ * error. The four partial products are summed without losing any carries.
+ */
+inline Fixed operator*(Fixed a, Fraction f)
+{
+    bool negative = a.raw() < 0;
+    uint32_t u = negative ? -(uint32_t)a.raw() : (uint32_t)a.raw();
+    uint16_t uh = u >> 16;
+    uint16_t ul = u;
+    uint16_t fh = f.raw() >> 16;
+    uint16_t fl = f.raw();
+    uint32_t mid_a = (uint32_t)uh * fl;
+    uint32_t mid_b = (uint32_t)ul * fh;
+    uint32_t carry = (mid_a & 0xFFFF) + (mid_b & 0xFFFF) + (((uint32_t)ul * fl) >> 16);
+    uint32_t result = (uint32_t)uh * fh + (mid_a >> 16) + (mid_b >> 16) + (carry >> 16);
+    return Fixed::from_raw(negative ? -(int32_t)result : (int32_t)result);
+}
+
+inline bool operator==(Fixed a, Fixed b) { return a.raw() == b.raw(); }
+inline bool operator!=(Fixed a, Fixed b) { return a.raw() != b.raw(); }
+inline bool operator<(Fixed a, Fixed b) { return a.raw() < b.raw(); }
+inline bool operator>(Fixed a, Fixed b) { return a.raw() > b.raw(); }
+inline bool operator<=(Fixed a, Fixed b) { return a.raw() <= b.raw(); }
+inline bool operator>=(Fixed a, Fixed b) { return a.raw() >= b.raw(); }
+
+inline Fixed fabsf(Fixed a)
+{
+    return a.raw() < 0 ? -a : a;
+}
+
+/***
+ * a * b for values that are not negative, limited to the largest Fixed
+ * instead of wrapping. Products within about one integer step of the
+ * limit also saturate.
+ */
+inline Fixed saturating_multiply(Fixed a, Fixed b)
+{
+    uint32_t bound = (uint32_t)((a.raw() >> 16) + 1) * (uint32_t)((b.raw() >> 16) + 1);
+    if (bound > 32767)
+    {
+        return Fixed::from_raw(INT32_MAX);
+    }
+    return a * b;
+}
+
+inline float saturating_multiply(float a, float b)
+{
+    return a * b;
+}
+
+inline float to_float(Fixed a)
+{
+    return a.to_float();
+}
+
+inline float to_float(float a)
+{
+    return a;
+}
+
+inline int to_int(Fixed a)
+{
+    return a.to_int();
+}
+
+inline int to_int(float a)
+{
+    return (int)a;
+}
+
+#if CONTROL_FIXED_POINT
+typedef Fixed real_t;
+typedef Fraction fraction_t;
+#else
+typedef float real_t;
+typedef float fraction_t;
+#endif
+
+#endif /* FIXED_POINT_H_ */
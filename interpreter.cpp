@@ -34,6 +34,8 @@
   SOFTWARE.
 */
 #include "interpreter.h"
+#include "binary-protocol.h"
+#include "calibration.h"
 #include "digitalWriteFast.h"
 #include "read-number.h"
 #include "settings.h"
@@ -41,8 +43,14 @@
 #include "tests.h"
 #include "motors.h"
 #include "profile.h"
+#include "motion-queue.h"
 #include "distance-moved.h"
 #include "sensors_control.h"
+#include "serial-out.h"
+#include "write-number.h"
+#include "telemetry.h"
+#include "isr-profiler.h"
+#include "systick.h"
 #include "misc_definitions.h"
 #include <Arduino.h>
 
@@ -76,11 +84,11 @@ int8_t ok()
 {
     if (verbose_errors)
     {
-        Serial.println(F("OK"));
+        tx.println(F("OK"));
     }
     else
     {
-        Serial.println(F("@Error:0"));
+        tx.println(F("@Error:0"));
     }
     return T_SILENT_ERROR;
 }
@@ -99,7 +107,7 @@ void interpreter_error(int8_t error, char *extra = 0)
     {
         if (error != T_OK)
         {
-            Serial.print(F("@Error:"));
+            tx.print(F("@Error:"));
         }
         switch (error)
         {
@@ -107,37 +115,44 @@ void interpreter_error(int8_t error, char *extra = 0)
                 ok();
                 break;
             case T_OUT_OF_RANGE:
-                Serial.println(F("Out of range"));
+                tx.println(F("Out of range"));
                 break;
             case T_READ_NOT_SUPPORTED:
-                Serial.println(F("Read not supported"));
+                tx.println(F("Read not supported"));
                 break;
             case T_LINE_TOO_LONG:
-                Serial.println(F("Too long"));
+                tx.println(F("Too long"));
                 break;
             case T_UNKNOWN_COMMAND:
-                Serial.print(F("Unknown "));
+                tx.print(F("Unknown "));
                 if (extra)
                 {
-                    Serial.println(extra);
+                    tx.println(extra);
                 }
                 else
                 {
-                    Serial.println();
+                    tx.println();
                 }
                 break;
             case T_UNEXPECTED_TOKEN:
-                Serial.println(F("Unexpected"));
+                tx.println(F("Unexpected"));
+                break;
+            case T_BAD_FRAME:
+                tx.println(F("Bad frame"));
+                break;
+            case T_BUSY:
+                tx.println(F("Busy"));
                 break;
             default:
-                Serial.println(F("Error"));
+                tx.println(F("Error"));
                 break;
         }
     }
     else
     {
-        Serial.print(F("@Error:"));
-        Serial.println(error);
+        tx.print(F("@Error:"));
+        print_integer(tx, error);
+        tx.println();
     }
 }
 
@@ -175,11 +190,12 @@ int8_t reset_state()
         stop_motors_and_everything_command();
 
         // We should reset all state here. At the moment there isn't any.
-        Serial.println(F("RST"));
+        tx.println(F("RST"));
 
         // Reset the actual state
         verbose_errors = TEXT_VERBOSE;
         interpreter_echo = true;
+        telemetry_stop();
     }
     return T_OK;
 }
@@ -190,7 +206,7 @@ int8_t reset_state()
  */
 int8_t show_version()
 {
-    Serial.println(F("v1.6"));
+    tx.println(F("v1.6"));
     return T_OK;
 }
 
@@ -200,7 +216,7 @@ int8_t show_version()
  */
 int8_t print_switches()
 {
-    Serial.println(readFunctionSwitch());
+    tx.println(readFunctionSwitch());
     return T_OK;
 }
 
@@ -224,67 +240,67 @@ int8_t motor_test()
     {
         case '0':
             setMotorVolts(0, 0);
-            Serial.println(F("motors off"));
+            tx.println(F("motors off"));
             break;
         case '1':
             setMotorVolts(1.5, 1.5);
-            Serial.println(F("forward 25%"));
+            tx.println(F("forward 25%"));
             break;
         case '2':
             setMotorVolts(3.0, 3.0);
-            Serial.println(F("forward 50%"));
+            tx.println(F("forward 50%"));
             break;
         case '3':
             setMotorVolts(4.5, 4.5);
-            Serial.println(F("forward 75%"));
+            tx.println(F("forward 75%"));
             break;
         case '4':
             setMotorVolts(-1.5, -1.5);
-            Serial.println(F("reverse 25%"));
+            tx.println(F("reverse 25%"));
             break;
         case '5':
             setMotorVolts(-3.0, -3.0);
-            Serial.println(F("reverse 50%"));
+            tx.println(F("reverse 50%"));
             break;
         case '6':
             setMotorVolts(-4.5, -4.5);
-            Serial.println(F("reverse 75%"));
+            tx.println(F("reverse 75%"));
             break;
         case '7':
             setMotorVolts(-1.5, 1.5);
-            Serial.println(F("spin left 25%"));
+            tx.println(F("spin left 25%"));
             break;
         case '8':
             setMotorVolts(-3.0, 3.0);
-            Serial.println(F("spin left 50%"));
+            tx.println(F("spin left 50%"));
             break;
         case '9':
             setMotorVolts(1.5, -1.5);
-            Serial.println(F("spin right 25%"));
+            tx.println(F("spin right 25%"));
             break;
         case 'a':
             setMotorVolts(3.0, -3.0);
-            Serial.println(F("spin right 50%"));
+            tx.println(F("spin right 50%"));
             break;
         case 'b':
             setMotorVolts(0, 1.5);
-            Serial.println(F("pivot left 25%"));
+            tx.println(F("pivot left 25%"));
             break;
         case 'c':
             setMotorVolts(1.5, 0);
-            Serial.println(F("pivot right 25%"));
+            tx.println(F("pivot right 25%"));
             break;
         case 'd':
             setMotorVolts(1.5, 3.0);
-            Serial.println(F("curve left"));
+            tx.println(F("curve left"));
             break;
         case 'e':
             setMotorVolts(3.0, 1.5);
-            Serial.println(F("curve right"));
+            tx.println(F("curve right"));
             break;
         case 'f':
             setMotorVolts(4.5, 3.0);
-            Serial.println(F("big curve right"));
+            tx.println(F("big curve right"));
             break;
         default:
             setMotorVolts(0, 0);
@@ -298,6 +314,7 @@ int8_t motor_test()
         {
             break; // stop running if the button is pressed
         }
+        serial_out_service();
     }
     // be sure to turn off the motors
     setMotorVolts(0, 0);
@@ -438,6 +455,68 @@ float decode_input_value_float(int index)
     }
 }
 
+/** @brief  Fetches the numeric arguments of the current command.
+ *          Text commands give them as comma separated values starting at
+ *          index. Binary commands carry them packed in the frame.
+ *  @param  index of where in the input should be parsed
+ *  @param  args array to receive the values
+ *  @param  count of values required
+ *  @return T_OK or T_UNEXPECTED_TOKEN if a separator is missing
+ */
+int8_t decode_float_arguments(int index, float *args, uint8_t count)
+{
+    if (binary_command_active())
+    {
+        return binary_float_arguments(args, count);
+    }
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (i != 0)
+        {
+            if (inputString[inputIndex] != ',')
+            {
+                return T_UNEXPECTED_TOKEN;
+            }
+            index = inputIndex + 1;
+        }
+        args[i] = decode_input_value_float(index);
+    }
+    return T_OK;
+}
+
+/** @brief As above, but up to 'optional' more arguments may follow the
+ *         required ones. Any that are left off are set to 0.
+ *  @return error code
+ */
+int8_t decode_float_arguments(int index, float *args, uint8_t count, uint8_t optional)
+{
+    for (uint8_t i = count; i < count + optional; i++)
+    {
+        args[i] = 0;
+    }
+    if (binary_command_active())
+    {
+        for (uint8_t n = count + optional; n > count; n--)
+        {
+            if (binary_float_arguments(args, n) == T_OK)
+            {
+                return T_OK;
+            }
+        }
+        return binary_float_arguments(args, count);
+    }
+    int8_t error = decode_float_arguments(index, args, count);
+    for (uint8_t i = count; error == T_OK and i < count + optional; i++)
+    {
+        if (inputString[inputIndex] != ',')
+        {
+            break;
+        }
+        args[i] = decode_input_value_float(inputIndex + 1);
+    }
+    return error;
+}
+
 /** @brief Reads or writes a digital GPIO
  *  @return Void.
  */
@@ -466,7 +545,8 @@ int8_t digital_pin_control()
         }
         else // read port
         {
-            Serial.println(digitalReadFast(port));
+            print_integer(tx, digitalReadFast(port));
+            tx.println();
         }
     }
     else
@@ -516,7 +596,8 @@ int8_t analogue_control()
         {
             if (port >= 0 or port <= 7)
             {
-                Serial.println(*(pointers_to_ADC_readings[port]));
+                print_integer(tx, *(pointers_to_ADC_readings[port]));
+                tx.println();
             }
             else
             {
@@ -577,11 +658,13 @@ int8_t encoder_values()
         // read motor
         if (motor == 1)
         {
-            Serial.println(encoder_left_total());
+            print_integer(tx, encoder_left_total());
+            tx.println();
         }
         else
         {
-            Serial.println(encoder_right_total());
+            print_integer(tx, encoder_right_total());
+            tx.println();
         }
     }
     else
@@ -590,29 +673,39 @@ int8_t encoder_values()
         if (c == 'h')
         {
             // read both encoder values ahead of time so print time doesn't offset.
-            int32_t left = encoder_left_total();
-            int32_t right = encoder_right_total();
+            int32_t left;
+            int32_t right;
             if (inputString[2] == 'z')
             {
-                reset_encoders();
+                take_encoder_totals(left, right);
+            }
+            else
+            {
+                encoder_totals(left, right);
             }
 
-            Serial.print(left, HEX);
-            Serial.print(",");
-            Serial.println(right, HEX);
+            print_hex(tx, left);
+            tx.print(",");
+            print_hex(tx, right);
+            tx.println();
         }
         else if (c == 0 or c == 'z')
         {
             // read both encoder values ahead of time so print time doesn't offset.
-            int32_t left = encoder_left_total();
-            int32_t right = encoder_right_total();
+            int32_t left;
+            int32_t right;
             if (c == 'z')
             {
-                reset_encoders();
+                take_encoder_totals(left, right);
+            }
+            else
+            {
+                encoder_totals(left, right);
             }
-            Serial.print(left);
-            Serial.print(",");
-            Serial.println(right);
+            print_integer(tx, left);
+            tx.print(",");
+            print_integer(tx, right);
+            tx.println();
         }
         else
         {
@@ -628,18 +721,13 @@ int8_t encoder_values()
 int8_t motor_control_dual_voltage()
 {
     disable_motor_controllers();
-    float motor_left = decode_input_value_float(1);
-    if (inputString[inputIndex] == ',')
+    float volts[2];
+    int8_t error = decode_float_arguments(1, volts, 2);
+    if (error != T_OK)
     {
-        // write PWM
-        //
-        float motor_right = decode_input_value_float(inputIndex + 1);
-        setMotorVolts(motor_left, motor_right); // should this be float or what?
-    }
-    else // no comma
-    {
-        return T_UNEXPECTED_TOKEN;
+        return error;
     }
+    setMotorVolts(volts[0], volts[1]); // should this be float or what?
     return T_OK;
 }
 
@@ -705,23 +793,27 @@ int8_t echo_command()
     int param = inputString[1];
     if (param == 'F')
     {
-        Serial.println(decode_input_value_float(2), DEFAULT_DECIMAL_PLACES);
+        print_float(tx, decode_input_value_float(2), DEFAULT_DECIMAL_PLACES);
+        tx.println();
     }
     else if (param == 'U')
     {
-        Serial.println(decode_input_value(2));
+        print_integer(tx, decode_input_value(2));
+        tx.println();
     }
     else if (param == 'S')
     {
-        Serial.println(decode_input_value_signed(2));
+        print_integer(tx, decode_input_value_signed(2));
+        tx.println();
     }
     else if (param == '*')
     {
-        Serial.println(inputString);
+        tx.println(inputString);
     }
     else
     {
-        Serial.println(decode_input_value_float(1), DEFAULT_DECIMAL_PLACES);
+        print_float(tx, decode_input_value_float(1), DEFAULT_DECIMAL_PLACES);
+        tx.println();
     }
     return T_OK;
 }
@@ -778,6 +870,8 @@ int8_t stop_motors_and_everything_command()
 
     // not strictly necessary, because we've disabled the
     // controller - but we do this anyway
+    forward_queue.clear();
+    rotation_queue.clear();
     forward.reset();
     rotation.reset();
     reset_motor_controllers();
@@ -792,7 +886,11 @@ int8_t stop_motors_and_everything_command()
 int8_t print_sensors_control_command()
 {
     int mode = inputString[1];
-    if (mode == 'h')
+    if (binary_command_active())
+    {
+        print_sensors_control('b'); // binary reply
+    }
+    else if (mode == 'h')
     {
         print_sensors_control('h'); // hex
     }
@@ -828,16 +926,19 @@ int8_t print_bat()
     if (inputString[1] == 'i')
     {
         int bat_int = bat * 1000;
-        Serial.println(bat_int);
+        print_integer(tx, bat_int);
+        tx.println();
     }
     else if (inputString[1] == 'h')
     {
         int bat_int = bat * 1000;
-        Serial.println(bat_int, 16);
+        print_hex(tx, bat_int);
+        tx.println();
     }
     else
     {
-        Serial.println(battery_voltage, DEFAULT_DECIMAL_PLACES);
+        print_float(tx, bat, DEFAULT_DECIMAL_PLACES);
+        tx.println();
     }
     return T_OK;
 }
@@ -861,27 +962,55 @@ void print_serial_capture_read_buff()
             char c = serial_capture_read_buff[offset];
             if (c < 32 or c > 126)
             {
-                Serial.print(hex[c >> 4]);
-                Serial.print(hex[c & 0xF]);
+                tx.print(hex[c >> 4]);
+                tx.print(hex[c & 0xF]);
             }
             else
             {
-                Serial.print(' ');
-                Serial.print(c);
+                tx.print(' ');
+                tx.print(c);
             }
         }
-        Serial.println("");
+        tx.println("");
     }
 }
 #endif
 
 int8_t tracking_steering_adjustment()
 {
-    float tracking = decode_input_value_float(1);
+    float tracking;
+    int8_t error = decode_float_arguments(1, &tracking, 1);
+    if (error != T_OK)
+    {
+        return error;
+    }
     g_steering_adjustment = tracking;
     return T_OK;
 }
 
+/** @brief  Reports the number of segments waiting in a motion queue.
+ *  @return error code
+ */
+int8_t print_queue_depth(const MotionQueue &queue)
+{
+    uint8_t depth = queue.depth();
+    print_unsigned(tx, depth);
+    tx.println();
+    return T_OK;
+}
+
+/** @brief  Reports how long the profile last started on an axis should
+ *          take, in seconds.
+ *  @return error code
+ */
+int8_t print_profile_duration(Profile &profile)
+{
+    float duration = profile.duration();
+    print_float(tx, duration, 3);
+    tx.println();
+    return T_OK;
+}
+
 int8_t position_speed_move()
 {
     char c = inputString[1];
@@ -891,27 +1020,54 @@ int8_t position_speed_move()
     }
     else if (c == 'z')
     {
+        forward_queue.clear();
         forward.reset();
     }
-    else // 1,2,3,4
+    else if (c == '#')
     {
-        float distance = decode_input_value_float(1);
-        if (inputString[inputIndex] != ',')
+        return print_queue_depth(forward_queue);
+    }
+    else if (c == 't')
+    {
+        return print_profile_duration(forward);
+    }
+    else if (c == '=') // move the end: distance,topSpeed,finalSpeed
+    {
+        float args[3];
+        int8_t error = decode_float_arguments(2, args, 3);
+        if (error != T_OK)
         {
-            return T_UNEXPECTED_TOKEN;
+            return error;
         }
-        float topSpeed = decode_input_value_float(inputIndex + 1);
-        if (inputString[inputIndex] != ',')
+        if (not forward.retarget(args[0], args[1], args[2]))
         {
-            return T_UNEXPECTED_TOKEN;
+            return T_OUT_OF_RANGE;
         }
-        float finalSpeed = decode_input_value_float(inputIndex + 1);
-        if (inputString[inputIndex] != ',')
+    }
+    else if (c == '+') // queue distance,topSpeed,finalSpeed,acceleration[,jerk]
+    {
+        float args[5];
+        int8_t error = decode_float_arguments(2, args, 4, 1);
+        if (error != T_OK)
+        {
+            return error;
+        }
+        if (not forward_queue.push(args[0], args[1], args[2], args[3], args[4]))
+        {
+            return T_BUSY;
+        }
+    }
+    else // distance,topSpeed,finalSpeed,acceleration[,jerk]
+    {
+        float args[5];
+        int8_t error = decode_float_arguments(1, args, 4, 1);
+        if (error != T_OK)
         {
-            return T_UNEXPECTED_TOKEN;
+            return error;
         }
-        float acceleration = decode_input_value_float(inputIndex + 1);
-        forward.start(distance, topSpeed, finalSpeed, acceleration);
+        // starts straight away, so anything queued would run after the wrong move
+        forward_queue.clear();
+        forward.start(args[0], args[1], args[2], args[3], args[4]);
     }
     return T_OK;
 }
@@ -925,28 +1081,125 @@ int8_t rotation_move()
     }
     else if (c == 'z')
     {
+        rotation_queue.clear();
         rotation.reset();
     }
-    else // 1,2,3,4
+    else if (c == '#')
     {
-        float distance = decode_input_value_float(1);
-        if (inputString[inputIndex] != ',')
+        return print_queue_depth(rotation_queue);
+    }
+    else if (c == 't')
+    {
+        return print_profile_duration(rotation);
+    }
+    else if (c == '=') // move the end: distance,topSpeed,finalSpeed
+    {
+        float args[3];
+        int8_t error = decode_float_arguments(2, args, 3);
+        if (error != T_OK)
         {
-            return T_UNEXPECTED_TOKEN;
+            return error;
         }
-        float topSpeed = decode_input_value_float(inputIndex + 1);
-        if (inputString[inputIndex] != ',')
+        if (not rotation.retarget(args[0], args[1], args[2]))
         {
-            return T_UNEXPECTED_TOKEN;
+            return T_OUT_OF_RANGE;
         }
-        float finalSpeed = decode_input_value_float(inputIndex + 1);
-        if (inputString[inputIndex] != ',')
+    }
+    else if (c == '+') // queue distance,topSpeed,finalSpeed,acceleration[,jerk]
+    {
+        float args[5];
+        int8_t error = decode_float_arguments(2, args, 4, 1);
+        if (error != T_OK)
+        {
+            return error;
+        }
+        if (not rotation_queue.push(args[0], args[1], args[2], args[3], args[4]))
+        {
+            return T_BUSY;
+        }
+    }
+    else // distance,topSpeed,finalSpeed,acceleration[,jerk]
+    {
+        float args[5];
+        int8_t error = decode_float_arguments(1, args, 4, 1);
+        if (error != T_OK)
+        {
+            return error;
+        }
+        // starts straight away, so anything queued would run after the wrong move
+        rotation_queue.clear();
+        rotation.start(args[0], args[1], args[2], args[3], args[4]);
+    }
+    return T_OK;
+}
+
+/** @brief  Arc move. The forward profile leads and the rotation profile
+ *          follows it at a fixed number of degrees per mm, so the radius is
+ *          constant and both axes finish on the same tick.
+ *  @return error code
+ */
+int8_t arc_move()
+{
+    char c = inputString[1];
+    if (c == 'z')
+    {
+        forward_queue.clear();
+        rotation_queue.clear();
+        forward.reset();
+        rotation.reset();
+        return T_OK;
+    }
+    // distance,turn,topSpeed,finalSpeed,acceleration[,jerk]
+    float args[6];
+    int8_t error = decode_float_arguments(c == '+' ? 2 : 1, args, 5, 1);
+    if (error != T_OK)
+    {
+        return error;
+    }
+    if (fabsf(args[0]) < 1)
+    {
+        return T_OUT_OF_RANGE; // no distance to share out the turn over
+    }
+    if (c == '+')
+    {
+        if (not forward_queue.push(args[0], args[2], args[3], args[4], args[5], args[1]))
         {
-            return T_UNEXPECTED_TOKEN;
+            return T_BUSY;
         }
-        float acceleration = decode_input_value_float(inputIndex + 1);
-        rotation.start(distance, topSpeed, finalSpeed, acceleration);
+        return T_OK;
+    }
+    forward_queue.clear();
+    rotation_queue.clear();
+    forward.start(args[0], args[2], args[3], args[4], args[5]);
+    rotation.follow(forward, args[1] / args[0]);
+    return T_OK;
+}
+
+/** @brief  Velocity mode. Sets the forward and rotation speeds at once and
+ *          both profiles ramp to them at the given accelerations. Unless
+ *          another 'd' comes within the timeout, both ramp down to zero.
+ *  @return error code
+ */
+int8_t velocity_move()
+{
+    // speed,omega,acceleration,angularAcceleration[,timeoutMs]
+    float args[5];
+    int8_t error = decode_float_arguments(1, args, 4, 1);
+    if (error != T_OK)
+    {
+        return error;
+    }
+    float timeout_ms = (args[4] > 0) ? args[4] : VELOCITY_TIMEOUT_MS;
+    float timeout_ticks = ceilf(timeout_ms * g_loop_frequency / 1000.0f);
+    if (timeout_ticks > 65535)
+    {
+        return T_OUT_OF_RANGE;
     }
+    // a host that is steering directly is not expecting the queues to start
+    forward_queue.clear();
+    rotation_queue.clear();
+    forward.drive(args[0], args[2], (uint16_t)timeout_ticks);
+    rotation.drive(args[1], args[3], (uint16_t)timeout_ticks);
     return T_OK;
 }
 
@@ -984,7 +1237,10 @@ int execute_settings_command(char *line)
         switch (line[1])
         {
             case '$':
-                dump_settings(5);
+                if (not dump_settings(5))
+                {
+                    return T_BUSY;
+                }
                 return T_OK;
                 break;
             case '#':
@@ -1004,7 +1260,10 @@ int execute_settings_command(char *line)
                 // list the settings names and types?
                 // or send them as a C declaration?
                 // or a JSON object ...
-                dump_settings_detail();
+                if (not dump_settings_detail())
+                {
+                    return T_BUSY;
+                }
                 return T_OK;
                 break;
         }
@@ -1028,7 +1287,7 @@ int execute_settings_command(char *line)
     if (line[pos++] != '=')
     {
         print_setting(index, 3); // no, just report the value
-        Serial.println();
+        tx.println();
         return T_OK;
     }
 
@@ -1050,6 +1309,28 @@ int8_t system_command()
     return execute_settings_command(inputString);
 }
 
+/** @brief  Switches between the text and the binary (COBS framed) protocol.
+ *          B1 enters binary mode, a binary B0 frame returns to text.
+ *  @return Void.
+ */
+int8_t binary_mode_control()
+{
+    char c = inputString[1];
+    if (c == '1')
+    {
+        enter_binary_mode();
+    }
+    else if (c == '0')
+    {
+        leave_binary_mode();
+    }
+    else
+    {
+        return T_OUT_OF_RANGE;
+    }
+    return T_OK;
+}
+
 int8_t not_implemented()
 {
     interpreter_error(T_UNKNOWN_COMMAND, inputString);
@@ -1094,7 +1375,7 @@ const PROGMEM fptr PROGMEM cmd2[] =
         ok,                            // '?'
         not_implemented,               // '@'
         analogue_control,              // 'A'
-        not_implemented,               // 'B'
+        binary_mode_control,           // 'B'
         encoder_values,                // 'C'
         digital_pin_control,           // 'D'
         echo_control,                  // 'E'
@@ -1103,19 +1384,19 @@ const PROGMEM fptr PROGMEM cmd2[] =
         not_implemented,               // 'H'
         not_implemented,               // 'I'
         not_implemented,               // 'J'
-        not_implemented,               // 'K'
-        not_implemented,               // 'L'
+        calibration_command,           // 'K'
+        loop_rate_command,             // 'L'
         motor_control,                 // 'M'
         motor_control_dual_voltage,    // 'N'
-        not_implemented,               // 'O'
+        serial_out_command,            // 'O'
         pinMode_command,               // 'P'
         not_implemented,               // 'Q'
         rotation_move,                 // 'R'
         print_sensors_control_command, // 'S'
         tracking_steering_adjustment,  // 'T'       // used to be old motor controller
-        not_implemented,               // 'U'
+        telemetry_command,             // 'U'
         verbose_control,               // 'V'
-        not_implemented,               // 'W'
+        motor_pwm_command,             // 'W'
         not_implemented,               // 'X'
         not_implemented,               // 'Y'
         not_implemented,               // 'Z'
@@ -1129,13 +1410,13 @@ const PROGMEM fptr PROGMEM cmd2[] =
         reset_state,                        // '^'
         not_implemented,                    // '_'
         not_implemented,                    // '`'
-        not_implemented,                    // 'a'
+        arc_move,                           // 'a'
         print_bat,                          // 'b'
         motor_control_control,              // 'c'
-        not_implemented,                    // 'd'
+        velocity_move,                      // 'd'
         print_encoders_command,             // 'e'
         not_implemented,                    // 'f'
-        not_implemented,                    // 'g'
+        state_snapshot_command,             // 'g'
         ok,                                 // 'h'
         not_implemented,                    // 'i'
         not_implemented,                    // 'j'
@@ -1148,7 +1429,7 @@ const PROGMEM fptr PROGMEM cmd2[] =
         cmd_test_runner,                    // 'q'
         print_encoder_setup,                // 'r'
         print_switches,                     // 's'
-        not_implemented,                    // 't'
+        profiler_command,                   // 't'
         not_implemented,                    // 'u'
         show_version,                       // 'v'
         not_implemented,                    // 'w'     // used to be print_wall_sensors
@@ -1161,31 +1442,147 @@ const PROGMEM fptr PROGMEM cmd2[] =
 };
 const int CMD2_SIZE = sizeof(cmd2) / sizeof(fptr);
 
-/** @brief  Finds the single character command from a list.
- *  @return Void.
+/** @brief  Finds the single character command from a list and runs it.
+ *          Shared by the text and binary front ends.
+ *  @return error code from the command
  */
-void parse_cmd()
+int8_t execute_command()
 {
     int command = inputString[0] - ' ';
-    if (command >= CMD2_SIZE)
+    if (command < 0 or command >= CMD2_SIZE)
     {
-        interpreter_error(T_UNKNOWN_COMMAND);
-        return;
+        return T_UNKNOWN_COMMAND;
     }
     fptr f = fptr(pgm_read_ptr(cmd2 + command));
-    interpreter_error(f());
+    return f();
+}
+
+/** @brief  Runs the command and reports any error.
+ *  @return Void.
+ */
+void parse_cmd()
+{
+    interpreter_error(execute_command());
+}
+
+/***
+ * Request tags. A command may start with '&' and up to five digits, e.g.
+ * '&12C'. Every line of its reply is then prefixed with the tag and a colon,
+ * e.g. '&12:1520,1498', and it always finishes with a status line (OK or
+ * @Error:) even if it would normally be silent. The host can then keep
+ * several commands in flight and match up the replies. Lines without a tag
+ * are either replies to untagged commands or, if they start with '@',
+ * unsolicited messages.
+ */
+#define TAG_CHAR '&'
+#define MAX_TAG_DIGITS 5
+static char tag_prefix[MAX_TAG_DIGITS + 3]; // '&', digits, ':' and terminator
+static uint8_t tag_length = 0;              // zero if the command has no tag
+static bool reading_tag = false;
+
+static void clear_tag()
+{
+    tag_length = 0;
+    reading_tag = false;
+}
+
+// only when tag_length is not zero
+static void begin_tagged_reply()
+{
+    tag_prefix[tag_length++] = ':';
+    tag_prefix[tag_length] = 0;
+    tx.set_line_prefix(tag_prefix);
+}
+
+static void end_tagged_reply()
+{
+    tx.set_line_prefix(0);
+    clear_tag();
+}
+
+/** @brief  Reports an error found while reading a command, e.g. a line that
+ *          is too long, under the command's tag if it has one.
+ *  @return Void.
+ */
+static void input_error(int8_t error)
+{
+    if (tag_length)
+    {
+        begin_tagged_reply();
+        interpreter_error(error);
+        end_tagged_reply();
+    }
+    else
+    {
+        interpreter_error(error);
+    }
+}
+
+/** @brief  Runs the command in inputString, tagging the reply if needed.
+ *  @return Void.
+ */
+static void run_input_command()
+{
+    inputString[inputIndex] = 0; // zero terminate
+    if (tag_length)
+    {
+        begin_tagged_reply();
+        int8_t error = T_OK;
+        if (inputIndex)
+        {
+            error = execute_command();
+        }
+        if (error == T_OK)
+        {
+            ok();
+        }
+        else
+        {
+            interpreter_error(error);
+        }
+        end_tagged_reply();
+    }
+    else
+    {
+        parse_cmd();
+    }
+    inputIndex = 0;
 }
 
 #define CTRL_C 0x03
 #define BACKSPACE 0x08
 #define CTRL_X 0x18
 static char last_NL = 0; // tracks NL changes
+static bool commands_on_line = false; // a ';' has already run a command on this line
+
+/***
+ * Several commands can be run in one pass of loop(), either from one line
+ * separated by ';' or from several lines already in the receive buffer. The
+ * first command always runs. Further ones run until the time budget is used
+ * up or there is not room for another reply, so loop() still gets to service
+ * telemetry and the serial output regularly. The rest wait for the next pass.
+ */
+const uint32_t INTERPRETER_TIME_BUDGET_US = 1000;
+const uint8_t INTERPRETER_REPLY_SPACE = 48;
+
+bool interpreter_may_continue(uint32_t start_time)
+{
+    serial_out_service();
+    return micros() - start_time < INTERPRETER_TIME_BUDGET_US and
+           tx.space_for(INTERPRETER_REPLY_SPACE);
+}
 
 /** @brief  Command line interpreter.
  *  @return Void.
  */
 void interpreter()
 {
+    if (binary_mode_enabled())
+    {
+        binary_interpreter();
+        return;
+    }
+    uint32_t start_time = micros();
     while (Serial.available())
     {
         char inChar = (char)Serial.read(); // get the new byte:
@@ -1199,13 +1596,48 @@ void interpreter()
         {
             if (interpreter_echo)
             {
-                Serial.write(inChar);
+                tx.write(inChar);
+            }
+
+            if (reading_tag)
+            {
+                if (inChar >= '0' and inChar <= '9' and tag_length <= MAX_TAG_DIGITS)
+                {
+                    tag_prefix[tag_length++] = inChar;
+                    continue;
+                }
+                reading_tag = false; // this character starts the command
+            }
+            else if (inChar == TAG_CHAR and inputIndex == 0 and tag_length == 0)
+            {
+                tag_prefix[0] = TAG_CHAR;
+                tag_length = 1;
+                reading_tag = true;
+                continue;
+            }
+
+            if (inChar == ';') // end of one command, more follow on this line
+            {
+                if (interpreter_echo)
+                {
+                    tx.println();
+                }
+                if (inputIndex or tag_length)
+                {
+                    run_input_command();
+                }
+                commands_on_line = true;
+                if (binary_mode_enabled() or not interpreter_may_continue(start_time))
+                {
+                    break;
+                }
+                continue;
             }
 
             inputString[inputIndex++] = inChar; // add it to the inputString:
             if (inputIndex == MAX_INPUT_SIZE)
             {
-                interpreter_error(T_LINE_TOO_LONG);
+                input_error(T_LINE_TOO_LONG);
                 inputIndex = 0;
             }
         }
@@ -1215,15 +1647,17 @@ void interpreter()
             if (inChar == '\n' or inChar == '\r')
             {
 
-                if (inputIndex) // characters in the input buffer - process them
+                if (inputIndex or tag_length) // characters in the input buffer - process them
                 {
                     if (interpreter_echo)
                     {
-                        Serial.println();
+                        tx.println();
                     }
-                    inputString[inputIndex] = 0; // zero terminate
-                    parse_cmd();
-                    inputIndex = 0;
+                    run_input_command();
+                }
+                else if (commands_on_line)
+                {
+                    // the line ended with a ';' - its commands have already run
                 }
                 else
                 {
@@ -1233,13 +1667,13 @@ void interpreter()
                     //
                     // So we need to check it wasn't a different one so we can ignore CRLF (or LFCR) pairs.
 
-                    //Serial.write(last_NL+'A'-1);
-                    //Serial.write(inChar+'A'-1);
+                    //tx.write(last_NL+'A'-1);
+                    //tx.write(inChar+'A'-1);
                     if (last_NL == 0 or inChar == last_NL)
                     {
                         if (interpreter_echo)
                         {
-                            Serial.println();
+                            tx.println();
                         }
                         // what do we want to print here? OK for V0?
                         ok();
@@ -1253,7 +1687,11 @@ void interpreter()
                 // This makes sure we track CR or LF as the accpeting character
                 // But this also ensures a change from, say, LFCR to CR will do the right thing
                 last_NL = inChar;
-                break; // go back to loop() once we've processed one command to run other loop things. One command at a time only!
+                commands_on_line = false;
+                if (binary_mode_enabled() or not interpreter_may_continue(start_time))
+                {
+                    break; // go back to loop() to run other loop things. The rest of the commands wait for the next pass.
+                }
             }
             else if (inChar == CTRL_X or inChar == CTRL_C)
             {
@@ -1262,15 +1700,17 @@ void interpreter()
                     stop_motors_and_everything_command();
                 }
                 inputIndex = 0;
-                Serial.println();
+                clear_tag();
+                commands_on_line = false;
+                tx.println();
             }
             else if (inChar == BACKSPACE and inputIndex != 0)
             {
                 inputIndex--;
 
                 // This sequence depends on terminal emulator
-                Serial.print("\x08 \x08");
-                //Serial.print("\x08");
+                tx.print("\x08 \x08");
+                //tx.print("\x08");
             }
         }
     }
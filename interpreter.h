@@ -38,12 +38,19 @@
 #ifndef INTERPRETER_H_
 #define INTERPRETER_H_
 
-#define MAX_INPUT_SIZE 14
+#include <stdint.h>
+
+#define MAX_INPUT_SIZE 44 // room for "a+", six arguments of up to six characters, the commas and the terminator
 extern char inputString[MAX_INPUT_SIZE]; // a String to hold incoming data
 extern int inputIndex;                   // where we are on the input
 void interpreter();
+int8_t execute_command();
+// true if there is time and output space to run another command this pass
+bool interpreter_may_continue(uint32_t start_time);
 
 int decode_input_value(int index);
+int8_t decode_float_arguments(int index, float *args, uint8_t count);
+int8_t decode_float_arguments(int index, float *args, uint8_t count, uint8_t optional);
 
 // These are the error codes produced by commands to pass into interpreter error.
 enum
@@ -54,7 +61,9 @@ enum
     T_READ_NOT_SUPPORTED = 2,
     T_LINE_TOO_LONG = 3,
     T_UNKNOWN_COMMAND = 4,
-    T_UNEXPECTED_TOKEN = 5
+    T_UNEXPECTED_TOKEN = 5,
+    T_BAD_FRAME = 6, // binary frame failed to decode or its CRC was wrong
+    T_BUSY = 7       // try again later: a settings dump is still being sent or a queue is full
 };
 
 #endif /* INTERPRETER_H_ */
@@ -0,0 +1,363 @@
+/*
+ * ISR profiler - time spent in each stage of the systick and ADC interrupts
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include "isr-profiler.h"
+#include "interpreter.h"
+#include "serial-out.h"
+#include "write-number.h"
+#include "binary-protocol.h"
+#include <Arduino.h>
+#include <util/atomic.h>
+
+static uint8_t s_period_counts = 250; // OCR2A + 1
+static uint8_t s_us_per_count = 8;
+static uint8_t s_late_start_counts = PROFILE_LATE_START_US / 8;
+
+struct StageTimes
+{
+    uint8_t min;
+    uint8_t max;
+    uint16_t count;
+    uint32_t total;
+};
+
+struct StageProfile
+{
+    StageTimes times;
+    uint16_t histogram[PROFILE_HISTOGRAM_BINS];
+};
+
+struct OverrunCounts
+{
+    uint16_t overruns;
+    uint16_t reentries;
+    uint16_t adc;
+    uint16_t late;
+};
+
+static StageProfile s_stages[PROFILE_STAGE_COUNT];
+static StageTimes s_adc_phases[PROFILE_ADC_PHASES];
+static OverrunCounts s_overrun_counts;
+static volatile bool s_in_systick;
+
+static const char stage_names[][5] PROGMEM = {"enc", "bat", "fwd", "rot", "ctl", "tick", "adc", "lat"};
+
+static uint8_t elapsed_counts(uint8_t start, uint8_t now)
+{
+    uint16_t end = now;
+    if (now < start or bit_is_set(TIFR2, OCF2A))
+    {
+        end += s_period_counts;
+    }
+    uint16_t counts = end - start;
+    return counts > 255 ? 255 : counts;
+}
+
+static void add_time(StageTimes &times, uint8_t counts)
+{
+    if (times.count == 0 or counts < times.min)
+    {
+        times.min = counts;
+    }
+    if (counts > times.max)
+    {
+        times.max = counts;
+    }
+    // stop before the mean goes wrong, about two minutes of samples
+    if (times.count < 0xFFFF)
+    {
+        times.count++;
+        times.total += counts;
+    }
+}
+
+uint8_t profiler_stage(ProfilerStage stage, uint8_t start)
+{
+    uint8_t now = profiler_now();
+    uint8_t counts = elapsed_counts(start, now);
+    StageProfile &profile = s_stages[stage];
+    add_time(profile.times, counts);
+    uint8_t bin = 0;
+    while (counts and bin < PROFILE_HISTOGRAM_BINS - 1)
+    {
+        counts >>= 1;
+        bin++;
+    }
+    if (profile.histogram[bin] < 0xFFFF)
+    {
+        profile.histogram[bin]++;
+    }
+    return now;
+}
+
+void profiler_adc_phase(uint8_t phase, uint8_t start)
+{
+    if (phase < PROFILE_ADC_PHASES)
+    {
+        add_time(s_adc_phases[phase], elapsed_counts(start, profiler_now()));
+    }
+}
+
+static void count_up(uint16_t &counter)
+{
+    if (counter < 0xFFFF)
+    {
+        counter++;
+    }
+}
+
+bool profiler_systick_enter()
+{
+    if (s_in_systick)
+    {
+        count_up(s_overrun_counts.reentries);
+        return false;
+    }
+    s_in_systick = true;
+    uint8_t latency = profiler_stage(PROFILE_LATENCY, 0);
+    if (latency >= s_late_start_counts)
+    {
+        count_up(s_overrun_counts.late);
+    }
+    return true;
+}
+
+void profiler_systick_exit()
+{
+    // the flag is set by the hardware at the compare match and only cleared
+    // when the ISR is entered, so if it is set the next tick is already late
+    if (bit_is_set(TIFR2, OCF2A))
+    {
+        count_up(s_overrun_counts.overruns);
+    }
+    s_in_systick = false;
+}
+
+void profiler_adc_overrun()
+{
+    count_up(s_overrun_counts.adc);
+}
+
+void profiler_reset()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        memset(s_stages, 0, sizeof(s_stages));
+        memset(s_adc_phases, 0, sizeof(s_adc_phases));
+        memset(&s_overrun_counts, 0, sizeof(s_overrun_counts));
+    }
+}
+
+void profiler_set_timebase(uint8_t period_counts, uint8_t us_per_count)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s_period_counts = period_counts;
+        s_us_per_count = us_per_count;
+        s_late_start_counts = PROFILE_LATE_START_US / us_per_count;
+    }
+    profiler_reset();
+}
+
+bool profiler_max_us(ProfilerStage stage, uint16_t &us)
+{
+    StageTimes times;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        times = s_stages[stage].times;
+    }
+    us = times.max * s_us_per_count;
+    return times.count > 0;
+}
+
+/***
+ * The report is too long for the output buffer so it is sent by an output
+ * job, one stage per line:
+ *   name,min,max,mean      in microseconds, or
+ *   name,bin0,...,bin7     for the histograms
+ */
+static bool s_histograms;
+
+static void print_times(const StageTimes &live)
+{
+    StageTimes times;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        times = live;
+    }
+    float mean = times.count ? (float)times.total * s_us_per_count / times.count : 0;
+    tx_bulk.print(',');
+    print_unsigned(tx_bulk, times.min * s_us_per_count);
+    tx_bulk.print(',');
+    print_unsigned(tx_bulk, times.max * s_us_per_count);
+    tx_bulk.print(',');
+    print_float(tx_bulk, mean, 1);
+    tx_bulk.println();
+}
+
+static void print_histogram(const StageProfile &live)
+{
+    uint16_t histogram[PROFILE_HISTOGRAM_BINS];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        memcpy(histogram, live.histogram, sizeof(histogram));
+    }
+    for (uint8_t i = 0; i < PROFILE_HISTOGRAM_BINS; i++)
+    {
+        tx_bulk.print(',');
+        print_unsigned(tx_bulk, histogram[i]);
+    }
+    tx_bulk.println();
+}
+
+static bool profiler_report_step(uint8_t step)
+{
+    if (step < PROFILE_STAGE_COUNT)
+    {
+        char name[5];
+        strcpy_P(name, stage_names[step]);
+        tx_bulk.print(name);
+        if (s_histograms)
+        {
+            print_histogram(s_stages[step]);
+        }
+        else
+        {
+            print_times(s_stages[step].times);
+        }
+        return true;
+    }
+    uint8_t phase = step - PROFILE_STAGE_COUNT;
+    if (s_histograms or phase >= PROFILE_ADC_PHASES)
+    {
+        return false;
+    }
+    tx_bulk.print('a');
+    print_unsigned(tx_bulk, phase);
+    print_times(s_adc_phases[phase]);
+    return true;
+}
+
+static OverrunCounts overrun_counts()
+{
+    OverrunCounts counts;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        counts = s_overrun_counts;
+    }
+    return counts;
+}
+
+static void print_overrun_counts(const OverrunCounts &counts)
+{
+    print_unsigned(tx, counts.overruns);
+    tx.print(',');
+    print_unsigned(tx, counts.reentries);
+    tx.print(',');
+    print_unsigned(tx, counts.adc);
+    tx.print(',');
+    print_unsigned(tx, counts.late);
+    tx.println();
+}
+
+/***
+ * Any overrun, re-entry or ADC overrun is worth a warning. A few late starts
+ * are normal when the encoders are busy, so they need to mount up first.
+ * At most one warning a second is sent, and none in binary mode.
+ */
+#define LATE_START_WARNING_COUNT 10
+#define OVERRUN_WARNING_INTERVAL 1000
+
+void profiler_warning_service()
+{
+    static OverrunCounts s_warned;
+    static uint32_t s_last_warning;
+    if (millis() - s_last_warning < OVERRUN_WARNING_INTERVAL or binary_mode_enabled())
+    {
+        return;
+    }
+    OverrunCounts counts = overrun_counts();
+    if (counts.overruns < s_warned.overruns or counts.reentries < s_warned.reentries or
+        counts.adc < s_warned.adc or counts.late < s_warned.late)
+    {
+        s_warned = counts; // cleared by tz
+        return;
+    }
+    bool serious = counts.overruns > s_warned.overruns or counts.reentries > s_warned.reentries or counts.adc > s_warned.adc;
+    if (not serious and counts.late - s_warned.late < LATE_START_WARNING_COUNT)
+    {
+        return;
+    }
+    if (not tx.space_for(32))
+    {
+        return;
+    }
+    tx.print(F("@Overrun:"));
+    print_overrun_counts(counts);
+    s_warned = counts;
+    s_last_warning = millis();
+}
+
+/** @brief  ISR timing report.
+ *          t   min,max,mean in us for each stage then each ADC phase
+ *          th  histogram for each stage
+ *          to  overruns,reentries,adc overruns,late starts
+ *          tz  clear all the timings and counts
+ *  @return error code
+ */
+int8_t profiler_command()
+{
+    char c = inputString[1];
+    if (c == 'z')
+    {
+        profiler_reset();
+        return T_OK;
+    }
+    if (c == 'o')
+    {
+        print_overrun_counts(overrun_counts());
+        return T_OK;
+    }
+    if (c != 0 and c != 'h')
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    s_histograms = c == 'h';
+    if (not serial_out_start_job(profiler_report_step))
+    {
+        return T_BUSY;
+    }
+    return T_OK;
+}
@@ -0,0 +1,111 @@
+/*
+ * ISR profiler - time spent in each stage of the systick and ADC interrupts
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#ifndef ISR_PROFILER_H_
+#define ISR_PROFILER_H_
+
+#include <Arduino.h>
+
+/***
+ * Times are measured with the Timer2 counter (TCNT2) that drives the
+ * systick. It counts from 0 to OCR2A once per tick: 250 counts of 8us at
+ * 500Hz, 125 counts of 8us at 1kHz and 125 counts of 4us at 2kHz. A time
+ * is the number of counts between two readings. If the counter has
+ * wrapped, or another systick is already pending, a whole period is
+ * added. Times are capped at 255 counts.
+ *
+ * Each stage keeps min, max, mean and a histogram. Histogram bin n counts
+ * the times of 2^(n-1) to 2^n - 1 counts: 0, 8us, 16-24us, 32-56us,
+ * 64-120us, 128-248us, 256-504us and 512us or more with 8us counts.
+ *
+ * The ADC phases run for only a few microseconds each, so most read as
+ * zero or one count. They keep min, max and mean only.
+ *
+ * The systick also checks itself for trouble, counting:
+ *   overruns   - the next tick was already due when a systick finished
+ *   reentries  - a systick started while the last one was still running.
+ *                ISR_NOBLOCK allows this. The nested one returns at once
+ *                so that tick is lost.
+ *   adc        - a sensor cycle was still running when the next started
+ *   late       - a systick started PROFILE_LATE_START_US or more after
+ *                its timer tick, held up by other interrupts
+ * loop() sends an '@Overrun:' warning when these go up.
+ */
+enum ProfilerStage : uint8_t
+{
+    PROFILE_ENCODERS = 0,    // update_encoders()
+    PROFILE_BATTERY = 1,     // update_battery_voltage()
+    PROFILE_FORWARD = 2,     // motion queues and forward.update()
+    PROFILE_ROTATION = 3,    // rotation.update()
+    PROFILE_CONTROLLERS = 4, // update_motor_controllers()
+    PROFILE_SYSTICK = 5,     // the whole systick ISR
+    PROFILE_ADC_CYCLE = 6,   // end of the systick to the last ADC phase
+    PROFILE_LATENCY = 7,     // timer tick to the start of the systick ISR
+    PROFILE_STAGE_COUNT = 8
+};
+
+#define PROFILE_HISTOGRAM_BINS 8
+#define PROFILE_ADC_PHASES 16
+#define PROFILE_LATE_START_US 64
+
+// time stamp for the start of a stage
+inline uint8_t profiler_now()
+{
+    return TCNT2;
+}
+
+// record a stage that started at start. Returns the time now, for the next stage.
+uint8_t profiler_stage(ProfilerStage stage, uint8_t start);
+void profiler_adc_phase(uint8_t phase, uint8_t start);
+
+// the first and last thing in the systick. False means the systick has
+// been re-entered and must return without doing anything.
+bool profiler_systick_enter();
+void profiler_systick_exit();
+void profiler_adc_overrun();
+
+// called from loop() to send any '@Overrun:' warning
+void profiler_warning_service();
+void profiler_reset();
+
+// called when the systick rate changes. Also clears all the timings.
+void profiler_set_timebase(uint8_t period_counts, uint8_t us_per_count);
+
+// longest time recorded for a stage. False if it has no samples yet.
+bool profiler_max_us(ProfilerStage stage, uint16_t &us);
+
+int8_t profiler_command();
+
+#endif /* ISR_PROFILER_H_ */
@@ -6,6 +6,9 @@
 // internal use
 #define MEASURE_TIMING 0
 
+// 1 to run the systick control chain in Q16.16 fixed point (see fixed-point.h)
+#define CONTROL_FIXED_POINT 0
+
 typedef unsigned long time_measure_t;
 #if MEASURE_TIMING
 #define TIME_START(START_VARIABLE) START_VARIABLE = micros();
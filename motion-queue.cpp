@@ -0,0 +1,99 @@
+/*
+ * Motion queue - profile segments waiting to run on each axis
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#include "motion-queue.h"
+#include <Arduino.h>
+#include <util/atomic.h>
+
+MotionQueue forward_queue;
+MotionQueue rotation_queue;
+
+/***
+ * A single producer (loop) and single consumer (systick) ring. The head and
+ * tail are bytes so reading them is atomic. They count up freely and are
+ * masked to index the array, so depth() is just their difference.
+ */
+bool MotionQueue::push(float distance, float top_speed, float final_speed, float acceleration, float jerk, float turn)
+{
+    if (depth() >= MOTION_QUEUE_SIZE)
+    {
+        return false;
+    }
+    Segment &segment = m_segments[m_head & (MOTION_QUEUE_SIZE - 1)];
+    segment.distance = distance;
+    segment.top_speed = top_speed;
+    segment.final_speed = final_speed;
+    segment.acceleration = acceleration;
+    segment.jerk = jerk;
+    segment.turn = turn;
+    m_head = m_head + 1; // only now can the ISR see it
+    return true;
+}
+
+void MotionQueue::clear()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        m_tail = m_head;
+    }
+}
+
+void MotionQueue::feed(Profile &profile, Profile *follower)
+{
+    if (m_head == m_tail or not profile.is_stopped())
+    {
+        return;
+    }
+    const Segment &segment = m_segments[m_tail & (MOTION_QUEUE_SIZE - 1)];
+    profile.chain(segment.distance, segment.top_speed, segment.final_speed, segment.acceleration, segment.jerk);
+    if (follower)
+    {
+        if (segment.turn != 0)
+        {
+            follower->follow(profile, segment.turn / segment.distance);
+        }
+        else
+        {
+            follower->unfollow();
+        }
+    }
+    m_tail = m_tail + 1;
+}
+
+void update_motion_queues()
+{
+    forward_queue.feed(forward, &rotation);
+    rotation_queue.feed(rotation);
+}
@@ -0,0 +1,91 @@
+/*
+ * Motion queue - profile segments waiting to run on each axis
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+#ifndef MOTION_QUEUE_H_
+#define MOTION_QUEUE_H_
+
+#include "profile.h"
+#include <stdint.h>
+
+/***
+ * Each axis has a short queue of profile segments. The systick starts the
+ * next segment in the same tick that the running one is found to have
+ * finished, so there is no gap at the join and, when the final speed of one
+ * segment is the start speed of the next, the robot does not slow down.
+ *
+ * The host fills the queues with 'p+' and 'R+' instead of waiting for each
+ * move to finish and sending the next one.
+ */
+#define MOTION_QUEUE_SIZE 4 // must be a power of two
+
+struct Segment
+{
+    float distance;
+    float top_speed;
+    float final_speed;
+    float acceleration;
+    float jerk; // 0 for a trapezoid
+    float turn; // forward queue only: degrees to turn on the way, 0 for a straight
+};
+
+class MotionQueue
+{
+public:
+    // from loop(). Returns false if the queue is full.
+    bool push(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0, float turn = 0);
+    void clear();
+    // number of segments waiting, not counting the one running
+    uint8_t depth() const
+    {
+        return (uint8_t)(m_head - m_tail);
+    }
+
+    // From the systick ISR, just before profile.update(). A segment with a
+    // turn makes the follower follow the profile round an arc; any other
+    // segment stops it following.
+    void feed(Profile &profile, Profile *follower = nullptr);
+
+private:
+    Segment m_segments[MOTION_QUEUE_SIZE];
+    volatile uint8_t m_head = 0; // written by loop() only
+    volatile uint8_t m_tail = 0; // written by the ISR, or by clear() with interrupts off
+};
+
+extern MotionQueue forward_queue;
+extern MotionQueue rotation_queue;
+
+void update_motion_queues();
+
+#endif /* MOTION_QUEUE_H_ */
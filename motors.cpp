@@ -34,21 +34,71 @@
 #include "digitalWriteFast.h"
 //#include "encoders.h"
 #include "distance-moved.h"
+#include "interpreter.h"
 #include "profile.h"
+#include "read-number.h"
 #include "sensors_control.h"
 #include "settings.h"
+#include "systick.h"
 #include "hardware_pins.h"
+#include "serial-out.h"
+#include "write-number.h"
 #include <arduino.h>
+#include <util/atomic.h>
 
 // these are maintained only for logging
-float g_left_motor_volts;
-float g_right_motor_volts;
+real_t g_left_motor_volts;
+real_t g_right_motor_volts;
+
+volatile uint16_t g_motor_pwm_top = 255;
+static uint16_t s_motor_pwm_prescale = 0; // not set up yet
 
 static bool s_controllers_output_enabled;
-static float s_old_fwd_error;
-static float s_old_rot_error;
-static float s_fwd_error;
-static float s_rot_error;
+static real_t s_old_fwd_error;
+static real_t s_old_rot_error;
+static real_t s_fwd_error;
+static real_t s_rot_error;
+static real_t s_fwd_integral; // volts
+static real_t s_rot_integral;
+
+static real_t s_fwd_kp;
+static real_t s_fwd_kd;
+static real_t s_fwd_ki; // per tick
+static real_t s_rot_kp;
+static real_t s_rot_kd;
+static real_t s_rot_ki;
+
+// feedforward, see update_controller_gains()
+struct WheelFeedforward
+{
+    real_t bias;  // volts, to overcome static friction
+    real_t speed; // volts per mm/s
+    real_t acc;   // volts per mm/s change in speed per tick
+    real_t old_speed;
+};
+static WheelFeedforward s_left_ff;
+static WheelFeedforward s_right_ff;
+
+// relay test, see start_relay_test()
+const uint8_t RELAY_SETTLING_CYCLES = 2;
+struct RelayTest
+{
+    volatile uint8_t axis;
+    real_t volts;
+    real_t hysteresis;
+    bool high;          // relay output is +volts
+    uint16_t ticks;     // since the relay last switched high
+    real_t max_error;   // this cycle
+    real_t min_error;
+    uint8_t cycles;     // completed, including settling
+    uint32_t sum_ticks; // over the cycles after settling
+    float sum_swing;
+};
+static RelayTest s_relay;
+
+const real_t MM_PER_DEG = (PI / 180.0) * MOUSE_RADIUS;
+const real_t MOTOR_VOLTS_LIMIT = MAX_MOTOR_VOLTS;
+
 Profile forward;
 Profile rotation;
 
@@ -68,6 +118,89 @@ void reset_motor_controllers()
     s_rot_error = 0;
     s_old_fwd_error = 0;
     s_old_rot_error = 0;
+    s_fwd_integral = 0;
+    s_rot_integral = 0;
+    s_left_ff.old_speed = 0;
+    s_right_ff.old_speed = 0;
+}
+
+/***
+ * The D terms work on the change in error per tick, which gets smaller as
+ * the loop runs faster. The KD settings are for LOOP_FREQUENCY so they are
+ * scaled to keep the same response at other rates. The I terms add up the
+ * error every tick so the KI settings, in volts per unit of error per
+ * second, are scaled the other way, as are the acceleration feedforward
+ * settings, which get the change in speed per tick.
+ */
+void update_controller_gains()
+{
+    float kd_scale = g_loop_frequency / LOOP_FREQUENCY;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s_fwd_kp = settings.fwdKP;
+        s_fwd_kd = settings.fwdKD * kd_scale;
+        s_fwd_ki = settings.fwdKI * g_loop_interval;
+        s_rot_kp = settings.rotKP;
+        s_rot_kd = settings.rotKD * kd_scale;
+        s_rot_ki = settings.rotKI * g_loop_interval;
+        s_left_ff.bias = settings.leftBiasFF;
+        s_left_ff.speed = settings.leftSpeedFF;
+        s_left_ff.acc = settings.leftAccFF * g_loop_frequency;
+        s_right_ff.bias = settings.rightBiasFF;
+        s_right_ff.speed = settings.rightSpeedFF;
+        s_right_ff.acc = settings.rightAccFF * g_loop_frequency;
+    }
+}
+
+/***
+ * analogWrite() looks up the timer for the pin in flash and sets up the
+ * output every call. On the ATmega328P pins 9 and 10 are the Timer1
+ * outputs OC1A and OC1B, so when the motors are on those the duty cycle is
+ * just written to the compare register; setup_motors() connects the
+ * outputs once. The pins are constants, so only one branch is compiled
+ * for each motor. Any other pin falls back to analogWrite().
+ *
+ * Timer1 runs in phase correct mode, where 0 holds the output low and
+ * the top (255, or 1023 for 10 bits) holds it high, as analogWrite() does
+ * for 0 and 255.
+ */
+#if defined(__AVR_ATmega328P__)
+const uint8_t OC1A_PIN = 9;
+const uint8_t OC1B_PIN = 10;
+#else
+const uint8_t OC1A_PIN = 0xFF; // no direct path, always use analogWrite()
+const uint8_t OC1B_PIN = 0xFF;
+#endif
+
+static inline void write_motor_pwm(uint8_t pin, uint16_t duty)
+{
+#if defined(__AVR_ATmega328P__)
+    if (pin == OC1A_PIN)
+    {
+        OCR1A = duty;
+        return;
+    }
+    if (pin == OC1B_PIN)
+    {
+        OCR1B = duty;
+        return;
+    }
+#endif
+    analogWrite(pin, duty);
+}
+
+static void connect_motor_pwm(uint8_t pin)
+{
+    if (pin == OC1A_PIN)
+    {
+        OCR1A = 0;
+        bitSet(TCCR1A, COM1A1);
+    }
+    else if (pin == OC1B_PIN)
+    {
+        OCR1B = 0;
+        bitSet(TCCR1A, COM1B1);
+    }
 }
 
 void setup_motors()
@@ -80,124 +213,362 @@ void setup_motors()
     digitalWriteFast(MOTOR_LEFT_DIR, 0);
     digitalWriteFast(MOTOR_RIGHT_PWM, 0);
     digitalWriteFast(MOTOR_RIGHT_DIR, 0);
-    set_motor_pwm_frequency();
+    update_motor_pwm();
+    connect_motor_pwm(MOTOR_LEFT_PWM);
+    connect_motor_pwm(MOTOR_RIGHT_PWM);
     stop_motors();
 }
 
-float position_controller()
+/***
+ * The integral can never need to be more than the motors can be given, so
+ * it is clamped there. That alone would still let it sit at the limit
+ * while the motors are saturated, and overshoot once they are not, so
+ * update_motor_controllers() also bleeds off the part of the output the
+ * motors could not use (back-calculation).
+ */
+static real_t clamp_integral(real_t integral)
+{
+    return constrain(integral, -MOTOR_VOLTS_LIMIT, MOTOR_VOLTS_LIMIT);
+}
+
+// Reduces the integral by the excess output, when it is pushing the same
+// way, but not past zero, so that an error too big for the P term alone
+// cannot wind it the other way.
+static real_t unwind_integral(real_t integral, real_t excess)
+{
+    if (integral > 0 && excess > 0)
+    {
+        return (excess < integral) ? integral - excess : real_t(0);
+    }
+    if (integral < 0 && excess < 0)
+    {
+        return (excess > integral) ? integral - excess : real_t(0);
+    }
+    return integral;
+}
+
+/***
+ * The volts a wheel should need for a speed without any feedback. The bias
+ * takes the sign of the speed, or of the acceleration when starting from
+ * rest, and the acceleration is how much the profile speed changed since
+ * the last tick.
+ */
+static real_t feedforward(WheelFeedforward &ff, real_t speed)
 {
-    s_fwd_error += forward.increment() - robot_fwd_increment();
-    float diff = s_fwd_error - s_old_fwd_error;
+    real_t change = speed - ff.old_speed;
+    ff.old_speed = speed;
+    real_t volts = ff.speed * speed + ff.acc * change;
+    real_t direction = (speed != 0) ? speed : change;
+    if (direction > 0)
+    {
+        volts += ff.bias;
+    }
+    else if (direction < 0)
+    {
+        volts -= ff.bias;
+    }
+    return volts;
+}
+
+real_t position_controller()
+{
+    s_fwd_error += forward.increment_isr() - robot_fwd_increment_isr();
+    real_t diff = s_fwd_error - s_old_fwd_error;
     s_old_fwd_error = s_fwd_error;
-    float output = settings.fwdKP * s_fwd_error + settings.fwdKD * diff;
+    s_fwd_integral = clamp_integral(s_fwd_integral + s_fwd_ki * s_fwd_error);
+    real_t output = s_fwd_kp * s_fwd_error + s_fwd_kd * diff + s_fwd_integral;
     return output;
 }
 
-float angle_controller(float steering_adjustment)
+real_t angle_controller(float steering_adjustment)
 {
-    s_rot_error += rotation.increment() - robot_rot_increment();
+    s_rot_error += rotation.increment_isr() - robot_rot_increment_isr();
     if (g_steering_enabled)
     {
-        s_rot_error += steering_adjustment;
+        s_rot_error += real_t(steering_adjustment);
     }
-    float diff = s_rot_error - s_old_rot_error;
+    real_t diff = s_rot_error - s_old_rot_error;
     s_old_rot_error = s_rot_error;
-    float output = settings.rotKP * s_rot_error + settings.rotKD * diff;
+    s_rot_integral = clamp_integral(s_rot_integral + s_rot_ki * s_rot_error);
+    real_t output = s_rot_kp * s_rot_error + s_rot_kd * diff + s_rot_integral;
     return output;
 }
 
+void start_relay_test(uint8_t axis, float volts, float hysteresis)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s_relay.volts = volts;
+        s_relay.hysteresis = hysteresis;
+        s_relay.high = true;
+        s_relay.ticks = 0;
+        s_relay.max_error = 0;
+        s_relay.min_error = 0;
+        s_relay.cycles = 0;
+        s_relay.sum_ticks = 0;
+        s_relay.sum_swing = 0;
+        s_relay.axis = axis;
+    }
+}
+
+void stop_relay_test()
+{
+    s_relay.axis = RELAY_OFF;
+}
+
+uint8_t relay_test_result(float &amplitude, float &period)
+{
+    uint8_t cycles;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        cycles = (s_relay.cycles > RELAY_SETTLING_CYCLES) ? s_relay.cycles - RELAY_SETTLING_CYCLES : 0;
+        amplitude = 0.5f * s_relay.sum_swing;
+        period = s_relay.sum_ticks * g_loop_interval;
+    }
+    if (cycles > 0)
+    {
+        amplitude /= cycles;
+        period /= cycles;
+    }
+    return cycles;
+}
+
+/***
+ * One tick of the relay. A cycle ends each time the output switches from
+ * low to high. The float sum is only done once a cycle.
+ */
+static real_t relay_output(real_t error)
+{
+    RelayTest &r = s_relay;
+    r.ticks++;
+    if (error > r.max_error)
+    {
+        r.max_error = error;
+    }
+    if (error < r.min_error)
+    {
+        r.min_error = error;
+    }
+    if (r.high and error < -r.hysteresis)
+    {
+        r.high = false;
+    }
+    else if (not r.high and error > r.hysteresis)
+    {
+        r.high = true;
+        if (r.cycles < 255)
+        {
+            r.cycles++;
+        }
+        if (r.cycles > RELAY_SETTLING_CYCLES)
+        {
+            r.sum_ticks += r.ticks;
+            r.sum_swing += to_float(r.max_error - r.min_error);
+        }
+        r.ticks = 0;
+        r.max_error = error;
+        r.min_error = error;
+    }
+    return r.high ? r.volts : -r.volts;
+}
+
 void update_motor_controllers(float steering_adjustment)
 {
-    float pos_output = position_controller();
-    float rot_output = angle_controller(steering_adjustment);
-    float left_output = 0;
-    float right_output = 0;
+    real_t pos_output = position_controller();
+    real_t rot_output = angle_controller(steering_adjustment);
+    if (s_relay.axis == RELAY_FORWARD)
+    {
+        pos_output = relay_output(s_fwd_error);
+    }
+    else if (s_relay.axis == RELAY_ROTATION)
+    {
+        rot_output = relay_output(s_rot_error);
+    }
+    real_t left_output = 0;
+    real_t right_output = 0;
     left_output += pos_output;
     right_output += pos_output;
     left_output -= rot_output;
     right_output += rot_output;
-    float v_fwd = forward.speed();
-    float v_rot = rotation.speed();
-    float v_left = v_fwd - (PI / 180.0) * MOUSE_RADIUS * v_rot;
-    float v_right = v_fwd + (PI / 180.0) * MOUSE_RADIUS * v_rot;
-    left_output += SPEED_FF * v_left;
-    right_output += SPEED_FF * v_right;
+    real_t v_fwd = forward.speed_isr();
+    real_t v_rot = rotation.speed_isr();
+    real_t v_left = v_fwd - MM_PER_DEG * v_rot;
+    real_t v_right = v_fwd + MM_PER_DEG * v_rot;
+    left_output += feedforward(s_left_ff, v_left);
+    right_output += feedforward(s_right_ff, v_right);
+    // anti-windup: share what set_*_motor_volts() will cut off between the two controllers
+    real_t left_excess = left_output - constrain(left_output, -MOTOR_VOLTS_LIMIT, MOTOR_VOLTS_LIMIT);
+    real_t right_excess = right_output - constrain(right_output, -MOTOR_VOLTS_LIMIT, MOTOR_VOLTS_LIMIT);
+    if (left_excess != 0 || right_excess != 0)
+    {
+        s_fwd_integral = unwind_integral(s_fwd_integral, (right_excess + left_excess) * real_t(0.5f));
+        s_rot_integral = unwind_integral(s_rot_integral, (right_excess - left_excess) * real_t(0.5f));
+    }
     if (s_controllers_output_enabled)
     {
         set_right_motor_volts(right_output);
         set_left_motor_volts(left_output);
     }
 }
-/**
- * Direct register access could be used here for enhanced performance
- */
 void set_left_motor_pwm(int pwm)
 {
-    pwm = MOTOR_LEFT_POLARITY * constrain(pwm, -255, 255);
+    int top = g_motor_pwm_top;
+    pwm = MOTOR_LEFT_POLARITY * constrain(pwm, -top, top);
     if (pwm < 0)
     {
         digitalWriteFast(MOTOR_LEFT_DIR, 1);
-        analogWrite(MOTOR_LEFT_PWM, -pwm);
+        write_motor_pwm(MOTOR_LEFT_PWM, -pwm);
     }
     else
     {
         digitalWriteFast(MOTOR_LEFT_DIR, 0);
-        analogWrite(MOTOR_LEFT_PWM, pwm);
+        write_motor_pwm(MOTOR_LEFT_PWM, pwm);
     }
 }
 
 void set_right_motor_pwm(int pwm)
 {
-    pwm = MOTOR_RIGHT_POLARITY * constrain(pwm, -255, 255);
+    int top = g_motor_pwm_top;
+    pwm = MOTOR_RIGHT_POLARITY * constrain(pwm, -top, top);
     if (pwm < 0)
     {
         digitalWriteFast(MOTOR_RIGHT_DIR, 1);
-        analogWrite(MOTOR_RIGHT_PWM, -pwm);
+        write_motor_pwm(MOTOR_RIGHT_PWM, -pwm);
     }
     else
     {
         digitalWriteFast(MOTOR_RIGHT_DIR, 0);
-        analogWrite(MOTOR_RIGHT_PWM, pwm);
+        write_motor_pwm(MOTOR_RIGHT_PWM, pwm);
     }
 }
 
-void set_left_motor_volts(float volts)
+bool motor_pwm_is_direct()
 {
-    volts = constrain(volts, -MAX_MOTOR_VOLTS, MAX_MOTOR_VOLTS);
+    return (MOTOR_LEFT_PWM == OC1A_PIN or MOTOR_LEFT_PWM == OC1B_PIN) and
+           (MOTOR_RIGHT_PWM == OC1A_PIN or MOTOR_RIGHT_PWM == OC1B_PIN);
+}
+
+void set_left_motor_volts(real_t volts)
+{
+    volts = constrain(volts, -MOTOR_VOLTS_LIMIT, MOTOR_VOLTS_LIMIT);
     g_left_motor_volts = volts;
-    int motorPWM = (int)(volts * g_battery_scale);
+    int motorPWM = to_int(volts * g_battery_scale);
     set_left_motor_pwm(motorPWM);
 }
 
-void set_right_motor_volts(float volts)
+void set_right_motor_volts(real_t volts)
 {
-    volts = constrain(volts, -MAX_MOTOR_VOLTS, MAX_MOTOR_VOLTS);
+    volts = constrain(volts, -MOTOR_VOLTS_LIMIT, MOTOR_VOLTS_LIMIT);
     g_right_motor_volts = volts;
-    int motorPWM = (int)(volts * g_battery_scale);
+    int motorPWM = to_int(volts * g_battery_scale);
     set_right_motor_pwm(motorPWM);
 }
 
-void set_motor_pwm_frequency(int frequency)
+/***
+ * Timer1 stays in phase correct PWM mode, which counts up to the top and
+ * back, so the frequency is F_CPU / (2 * prescale * top). The motors are
+ * stopped while it changes; the next systick sets them again.
+ */
+bool set_motor_pwm_mode(int bits, int prescale)
 {
-    switch (frequency)
+    uint8_t clock_select;
+    switch (prescale)
     {
-        case PWM_31250_HZ:
-            // Divide by 1. frequency = 31.25 kHz;
-            bitClear(TCCR1B, CS11);
-            bitSet(TCCR1B, CS10);
+        case 1:
+            clock_select = _BV(CS10);
             break;
-        case PWM_3906_HZ:
-            // Divide by 8. frequency = 3.91 kHz;
-            bitSet(TCCR1B, CS11);
-            bitClear(TCCR1B, CS10);
+        case 8:
+            clock_select = _BV(CS11);
             break;
-        case PWM_488_HZ:
-        default:
-            // Divide by 64. frequency = 488Hz;
-            bitSet(TCCR1B, CS11);
-            bitSet(TCCR1B, CS10);
+        case 64:
+            clock_select = _BV(CS11) | _BV(CS10);
             break;
+        default:
+            return false;
+    }
+    if (bits != 8 and bits != 10)
+    {
+        return false;
+    }
+    if (bits == 10 and not motor_pwm_is_direct())
+    {
+        return false; // analogWrite() only does 8 bits
+    }
+    if (bits == motor_pwm_bits() and prescale == s_motor_pwm_prescale)
+    {
+        return true; // leave the motors running
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        // WGM13:10 is 0001 for 8 bits and 0011 for 10 bits
+        uint8_t wave = _BV(WGM10) | ((bits == 10) ? _BV(WGM11) : 0);
+        TCCR1A = (TCCR1A & ~(_BV(WGM11) | _BV(WGM10))) | wave;
+        TCCR1B = (TCCR1B & ~(_BV(WGM13) | _BV(WGM12) | _BV(CS12) | _BV(CS11) | _BV(CS10))) | clock_select;
+        g_motor_pwm_top = (bits == 10) ? 1023 : 255;
+        s_motor_pwm_prescale = prescale;
+        write_motor_pwm(MOTOR_LEFT_PWM, 0);
+        write_motor_pwm(MOTOR_RIGHT_PWM, 0);
+    }
+    return true;
+}
+
+void update_motor_pwm()
+{
+    if (not set_motor_pwm_mode(settings.motorPwmBits, settings.motorPwmPrescale))
+    {
+        set_motor_pwm_mode(8, 1);
+    }
+}
+
+uint8_t motor_pwm_bits()
+{
+    return (g_motor_pwm_top == 1023) ? 10 : 8;
+}
+
+/** @brief  W on its own replies bits,prescale,frequency in Hz.
+ *          Wb,p sets the bits and prescale and stores them in the settings.
+ *  @return error code
+ */
+int8_t motor_pwm_command()
+{
+    if (inputString[1] == 0)
+    {
+        print_unsigned(tx, motor_pwm_bits());
+        tx.print(',');
+        print_unsigned(tx, s_motor_pwm_prescale);
+        tx.print(',');
+        print_unsigned(tx, (uint32_t)(motor_pwm_frequency() + 0.5f));
+        tx.println();
+        return T_OK;
+    }
+    uint8_t pos = 1;
+    int bits;
+    int prescale;
+    if (not read_integer(inputString, &pos, &bits) or inputString[pos] != ',')
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    pos++;
+    if (not read_integer(inputString, &pos, &prescale) or inputString[pos] != 0)
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    if (not set_motor_pwm_mode(bits, prescale))
+    {
+        return T_OUT_OF_RANGE;
+    }
+    settings.motorPwmBits = bits;
+    settings.motorPwmPrescale = prescale;
+    return T_OK;
+}
+
+float motor_pwm_frequency()
+{
+    if (s_motor_pwm_prescale == 0)
+    {
+        return 0;
     }
+    return F_CPU / (2.0f * s_motor_pwm_prescale * g_motor_pwm_top);
 }
 
 void stop_motors()
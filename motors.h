@@ -34,9 +34,12 @@
 #define MOTORS_H
 
 // #include <arduino.h>
+#include "fixed-point.h"
 
-extern float g_left_motor_volts;
-extern float g_right_motor_volts;
+extern real_t g_left_motor_volts;
+extern real_t g_right_motor_volts;
+// the PWM value for full drive, 255 or 1023. See set_motor_pwm_mode()
+extern volatile uint16_t g_motor_pwm_top;
 
 //***************************************************************************//
 
@@ -44,6 +47,13 @@ void enable_motor_controllers();
 void disable_motor_controllers();
 void reset_motor_controllers();
 
+/***
+ * The controllers keep their own copy of the gains in the control number
+ * type so that systick does not convert them on every tick.
+ * @brief copy the controller gains from settings. Call after any change.
+ */
+void update_controller_gains();
+
 /***
  * The motors module provides low  control of the drive motors
  * in a two-wheel differential drive robot.
@@ -51,14 +61,27 @@ void reset_motor_controllers();
 
 void update_motor_controllers(float steering_adjustment);
 
-enum { PWM_488_HZ,
-       PWM_3906_HZ,
-       PWM_31250_HZ };
+/***
+ * Relay feedback test for autotuning (see calibration.cpp). While it runs,
+ * the chosen axis is driven by a relay of +/- 'volts' on the sign of its
+ * controller error instead of by its controller, with 'hysteresis' units
+ * of error before each switch. The other axis is controlled as usual. The
+ * systick times each full cycle and records its peak to peak error.
+ */
+enum { RELAY_OFF,
+       RELAY_FORWARD,
+       RELAY_ROTATION };
+void start_relay_test(uint8_t axis, float volts, float hysteresis);
+void stop_relay_test();
+// Averages over the cycles so far, ignoring the first few while it
+// settles. The amplitude is half the peak to peak error. Returns the
+// number of cycles averaged.
+uint8_t relay_test_result(float &amplitude, float &period);
 
 /***
  *  - set the motor driver pins as outputs
  *  - configure direction to be forwards
- *  - set pwm frequency to default 32kHz
+ *  - set the pwm resolution and frequency from the settings
  *  - set pwm drive to zero
  * @brief configure pins and pwm for motor drive
  */
@@ -70,16 +93,28 @@ void setup_motors();
 void stop_motors();
 
 /***
- * @brief set the motor pwn drive to one of three possible values
+ * bits is 8 or 10 and prescale is 1, 8 or 64, giving
+ *    8 bits:  31.4kHz, 3.92kHz or 490Hz
+ *   10 bits:  7.82kHz,  978Hz or 122Hz
+ * 10 bits needs the motors on the Timer1 pins (see motor_pwm_is_direct()).
+ * Takes ints so that settings and commands are range checked here, whole.
+ * @brief set the motor PWM resolution and frequency. False if not possible
  */
-void set_motor_pwm_frequency(int frequency = PWM_31250_HZ);
+bool set_motor_pwm_mode(int bits, int prescale);
+// from the settings, or 8 bits at 31.4kHz if they are not possible
+void update_motor_pwm();
+uint8_t motor_pwm_bits();
+float motor_pwm_frequency(); // Hz
+int8_t motor_pwm_command();
 
 /***
- * -255 <= pwm <= 255
+ * -g_motor_pwm_top <= pwm <= g_motor_pwm_top
  * @brief set motor direction and PWM
  */
 void set_left_motor_pwm(int pwm);
 void set_right_motor_pwm(int pwm);
+// true when both motor PWMs are written straight to Timer1 registers
+bool motor_pwm_is_direct();
 
 /***
  * The input voltage be any value and will be scaled to compensate for changes
@@ -87,7 +122,7 @@ void set_right_motor_pwm(int pwm);
  * value of MAX_MOTOR_VOLTS in the defaults (normally +/- 6.0 Volts)
  * @brief adjust the motor PWM to deliver the given volate to the motor
  */
-void set_left_motor_volts(float volts);
-void set_right_motor_volts(float volts);
+void set_left_motor_volts(real_t volts);
+void set_right_motor_volts(real_t volts);
 
 #endif
@@ -34,7 +34,9 @@
 #define PROFILE_H
 
 //#include "encoders.h"
+#include "fixed-point.h"
 #include "settings.h"
+#include "systick.h"
 #include <Arduino.h>
 #include <util/atomic.h>
 //***************************************************************************//
@@ -48,6 +50,31 @@ enum ProfileState : uint8_t {
   CS_ACCELERATING = 1,
   CS_BRAKING = 2,
   CS_FINISHED = 3,
+  CS_VELOCITY = 4, // no end, see drive()
+};
+
+// the speed a profile with a final speed of zero creeps at to reach the end
+const float PROFILE_CREEP_SPEED = 5.0f;
+// how long a velocity mode speed lasts if the timeout is not given
+const uint16_t VELOCITY_TIMEOUT_MS = 200;
+// a tick that never comes
+const uint32_t NEVER = 0xFFFFFFFF;
+// longer S-curves than this fall back to a trapezoid so tick counts fit 16 bits
+const uint16_t MAX_PROFILE_TICKS = 60000;
+
+/***
+ * One jerk limited change of speed, planned in whole ticks when the profile
+ * starts.
+ * The acceleration rises by 'jerk' each tick for jerk_ticks, holds, then
+ * falls for jerk_ticks, so the speed changes by exactly
+ * jerk * jerk_ticks * (total_ticks - jerk_ticks) before end_speed is set
+ * to remove any rounding.
+ */
+struct Ramp {
+  uint16_t jerk_ticks;
+  uint16_t total_ticks;
+  real_t jerk; // change in the per tick speed change, signed
+  real_t end_speed;
 };
 
 class Profile {
@@ -58,6 +85,8 @@ class Profile {
       m_speed = 0;
       m_target_speed = 0;
       m_state = CS_IDLE;
+      m_following = false;
+      m_starts++;
     }
   }
 
@@ -70,34 +99,105 @@ class Profile {
 
   bool is_finished() { return m_state == CS_FINISHED; }
 
-  void start(float distance, float top_speed, float final_speed, float acceleration) {
-    m_sign = (distance < 0) ? -1 : +1;
-    if (distance < 0) {
-      distance = -distance;
+  // true when a new profile can be started without cutting one short
+  bool is_stopped() { return m_state == CS_IDLE || m_state == CS_FINISHED; }
+
+  // A jerk of zero gives a trapezoid. Otherwise the acceleration ramps up and
+  // down at no more than 'jerk' (units/s/s/s) so the speed follows an S-curve.
+  //
+  // The plan is made here in loop(), which can take a few hundred
+  // microseconds for an S-curve. The profile is made idle first so that
+  // update() leaves it alone, and the new state is only set once the plan
+  // is complete. The speed holds meanwhile. An idle profile can be fed from
+  // its queue, so the caller empties that first.
+  void start(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_state = CS_IDLE;
+      m_following = false;
+      m_retarget = false;
     }
-    if (distance < 1.0) {
-      m_state = CS_FINISHED;
-      return;
+    begin(distance, top_speed, final_speed, acceleration, jerk, 0);
+  }
+
+  // Start the next segment of a sequence. Any distance already travelled
+  // past the end of the last one is counted towards the new one so that
+  // chained segments add up to exactly the total distance.
+  void chain(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    real_t carried = fabsf(m_position) - m_final_position;
+    begin(distance, top_speed, final_speed, acceleration, jerk, (carried > 0) ? carried : real_t(0));
+  }
+
+  // Move the end of a running profile without restarting it. The distance
+  // is from where the profile started, in the same direction, and the plan
+  // is made again from the current speed and position, so the speed carries
+  // on smoothly. A profile that was given a jerk limit stays an S-curve and
+  // carries on from its current acceleration. The new plan is made in
+  // the next systick rather than here with interrupts off. Returns false if
+  // no move is running, or the distance is the other way.
+  bool retarget(float distance, float top_speed, float final_speed) {
+    bool accepted = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (!is_stopped() && m_state != CS_VELOCITY && !m_following && (distance < 0) == (m_sign < 0)) {
+        m_new_distance = fabsf(distance);
+        m_new_top_speed = fabsf(top_speed);
+        m_new_final_speed = fabsf(final_speed);
+        m_retarget = true;
+        accepted = true;
+      }
     }
-    if (final_speed > top_speed) {
-      final_speed = top_speed;
+    return accepted;
+  }
+
+  // Velocity mode: head for a speed at no more than 'acceleration', with no
+  // end position. Each call must come within 'timeout_ticks' of the last or
+  // the speed ramps down to zero and the profile finishes.
+  void drive(float speed, float acceleration, uint16_t timeout_ticks) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_following = false;
+      m_retarget = false;
+      m_s_curve = false;
+      m_acceleration = max(fabsf(acceleration), 1.0f);
+      m_delta_v = m_acceleration * g_loop_interval;
+      m_target_speed = speed;
+      m_velocity_ticks = max(timeout_ticks, (uint16_t)1);
+      m_state = CS_VELOCITY;
+      m_starts++;
     }
+  }
 
-    m_position = 0;
-    m_final_position = distance;
-    m_target_speed = m_sign * fabsf(top_speed);
-    m_final_speed = m_sign * fabsf(final_speed);
-    m_acceleration = fabsf(acceleration);
-    if (m_acceleration >= 1) {
-      m_one_over_acc = 1.0f / m_acceleration;
-    } else {
-      m_one_over_acc = 1.0;
+  // Follow another profile, scaled by ratio, for an arc. The speed and
+  // position are copied from the leader every tick, after it has updated,
+  // so the two share one time base and finish on the same tick. Starting,
+  // stopping or resetting this profile ends it, as does unfollow(). So does
+  // starting, resetting or driving the leader, unless follow() is called
+  // again straight after, as for the next arc in a queue.
+  void follow(Profile &leader, float ratio) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_leader = &leader;
+      m_leader_starts = leader.m_starts;
+      m_ratio = ratio;
+      m_delta_v = leader.m_delta_v * real_t(fabsf(ratio));
+      m_planned_ticks = leader.m_planned_ticks;
+      m_target_speed = 0;
+      m_following = true;
+      follow_leader();
+    }
+  }
+
+  // Any speed left over from the leader's final speed ramps down at the
+  // leader's acceleration, scaled.
+  void unfollow() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (m_following) {
+        m_following = false;
+        m_state = CS_FINISHED;
+      }
     }
-    m_state = CS_ACCELERATING;
   }
 
   void stop() {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_following = false;
       m_target_speed = 0;
     }
     finish();
@@ -112,33 +212,22 @@ class Profile {
 
   void set_state(ProfileState state) { m_state = state; }
 
-  float get_braking_distance() {
-    return fabsf(m_speed * m_speed - m_final_speed * m_final_speed) * 0.5 * m_one_over_acc;
-  }
-
-  float position() {
-    float pos;
+  // how long the last profile started should take, in seconds, from the plan
+  float duration() {
+    uint32_t ticks;
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      pos = m_position;
+      ticks = m_planned_ticks;
     }
-    return pos;
+    return ticks * g_loop_interval;
   }
 
-  float speed() {
-    float speed;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      speed = m_speed;
-    }
-    return speed;
-  }
+  // Systick only. loop() reads the position and speed from the published
+  // control state (control-state.h) so that it never masks interrupts.
+  real_t position_isr() { return m_position; }
 
-  float increment() {
-    float inc;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      inc = m_speed * LOOP_INTERVAL;
-    }
-    return inc;
-  }
+  real_t speed_isr() { return m_speed; }
+
+  real_t increment_isr() { return m_speed * g_loop_dt; }
 
   float acceleration() {
     float acc;
@@ -161,7 +250,7 @@ class Profile {
 
   // normally only used to alter position for forward error correction
   void adjust_position(float adjustment) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { m_position += adjustment; }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { m_position += real_t(adjustment); }
   }
 
   void set_position(float position) {
@@ -170,52 +259,509 @@ class Profile {
 
   // update is called from within systick and shoul dbe safe from interrupts
   void update() {
+    if (m_following) {
+      if (m_leader->m_starts == m_leader_starts) {
+        follow_leader();
+        return;
+      }
+      unfollow(); // the leader has moved on to something else
+    }
+    if (m_retarget) {
+      replan();
+    }
     if (m_state == CS_IDLE) {
       return;
     }
-    float delta_v = m_acceleration * LOOP_INTERVAL;
-    float remaining = fabsf(m_final_position) - fabsf(m_position);
-    if (m_state == CS_ACCELERATING) {
-      if (remaining < get_braking_distance()) {
-        m_state = CS_BRAKING;
-        if (m_final_speed == 0) {
-          m_target_speed = m_sign * 5.0f;
-        } else {
-          m_target_speed = m_final_speed;
-        };
+    if (m_state == CS_VELOCITY) {
+      if (--m_velocity_ticks == 0) {
+        // not refreshed in time, so stop
+        m_target_speed = 0;
+        m_state = CS_FINISHED;
       }
+      approach_target_speed();
+      m_position += m_speed * g_loop_dt;
+      return;
+    }
+    // like the braking point, judged on where the profile was at the start of the tick
+    bool at_end = passed(m_finish_position);
+    bool following_plan = false;
+    if (m_s_curve && m_state != CS_FINISHED) {
+      following_plan = follow_s_curve();
+    } else {
+      if (m_state == CS_ACCELERATING) {
+        if (m_tick == m_brake_tick || (m_tick >= m_top_tick && passed(m_brake_position))) {
+          m_state = CS_BRAKING;
+          if (m_final_speed == 0) {
+            m_target_speed = m_sign * PROFILE_CREEP_SPEED;
+          } else {
+            m_target_speed = m_final_speed;
+          };
+        }
+        m_tick++;
+      }
+      approach_target_speed();
+    }
+    // increment the position
+    m_position += m_speed * g_loop_dt;
+    if (m_s_curve) {
+      // the plan ends exactly at the end, so don't wait another tick to see it
+      at_end = passed(m_finish_position);
     }
-    // try to reach the target speed
+    if (m_state != CS_FINISHED && !following_plan && at_end) {
+      m_state = CS_FINISHED;
+      m_target_speed = m_final_speed;
+    }
+  }
+
+  private:
+  void approach_target_speed() {
     if (m_speed < m_target_speed) {
-      m_speed += delta_v;
+      m_speed += m_delta_v;
       if (m_speed > m_target_speed) {
         m_speed = m_target_speed;
       }
     }
     if (m_speed > m_target_speed) {
-      m_speed -= delta_v;
+      m_speed -= m_delta_v;
       if (m_speed < m_target_speed) {
         m_speed = m_target_speed;
       }
     }
-    // increment the position
-    m_position += m_speed * LOOP_INTERVAL;
-    if (m_state != CS_FINISHED && remaining < 0.125) {
+  }
+
+  void begin(float distance, float top_speed, float final_speed, float acceleration, float jerk, real_t carried) {
+    m_following = false;
+    m_retarget = false;
+    m_starts++;
+    m_sign = (distance < 0) ? -1 : +1;
+    if (distance < 0) {
+      distance = -distance;
+    }
+    if (distance < 1.0) {
       m_state = CS_FINISHED;
+      return;
+    }
+    if (final_speed > top_speed) {
+      final_speed = top_speed;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_position = m_sign * carried; // published by the systick even when idle
+    }
+    m_final_position = distance;
+    m_target_speed = m_sign * fabsf(top_speed);
+    m_final_speed = m_sign * fabsf(final_speed);
+    // the plans divide by it, and less than 1 unit/s/s is never meant
+    m_acceleration = max(fabsf(acceleration), 1.0f);
+    // the float work is done here so that update() only has to add and compare
+    m_delta_v = m_acceleration * g_loop_interval;
+    m_finish_position = m_sign * (distance - 0.125f);
+    m_jerk = fabsf(jerk);
+    m_ramp_acc = 0;
+    plan(fabsf(top_speed), fabsf(final_speed), m_jerk);
+  }
+
+  // the rest of a retarget(), in the systick
+  void replan() {
+    m_retarget = false;
+    if (is_stopped()) {
+      return; // it finished before the systick got here
+    }
+    float top_speed = m_new_top_speed;
+    float final_speed = min(m_new_final_speed, top_speed);
+    m_final_position = m_new_distance;
+    m_target_speed = m_sign * top_speed;
+    m_final_speed = m_sign * final_speed;
+    m_finish_position = m_sign * (m_new_distance - 0.125f);
+    // An S-curve carries on from its current acceleration. If there is no
+    // longer room to reach the final speed that way, plan_s_curve() fails
+    // and the trapezoid brakes harder at once.
+    plan(top_speed, final_speed, m_jerk);
+  }
+
+  // Plans from the current speed, acceleration and position to
+  // m_final_position. The state is set last, so that a profile started
+  // from loop() only runs once the plan is complete.
+  void plan(float top_speed, float final_speed, float jerk) {
+    m_tick = 0;
+    m_release_ticks = 0;
+    m_s_curve = jerk >= 1 && plan_s_curve(top_speed, final_speed, jerk);
+    if (!m_s_curve) {
+      m_ramp_acc = 0;
+      plan_trapezoid(top_speed, final_speed);
+    }
+    m_state = CS_ACCELERATING;
+  }
+
+  void follow_leader() {
+    m_speed = m_leader->m_speed * m_ratio;
+    m_position = m_leader->m_position * m_ratio;
+    m_state = m_leader->m_state;
+  }
+
+  // True once the position is beyond a point, in the direction of travel.
+  // Comparing signed positions saves taking fabsf() every tick.
+  bool passed(real_t point) { return (m_sign > 0) ? m_position > point : m_position < point; }
+
+  // The trapezoid starts braking on the first tick that the distance to go
+  // is less than the braking distance from the current speed, with both
+  // judged before the tick's change of speed. The braking distance is
+  // |v^2 - vf^2| / 2a, so the creep and the speed up to a higher final
+  // speed come out as before. This finds that tick once, so update() only
+  // has to count ticks and compare positions:
+  //  - while the speed ramps towards the top speed the tick is found from
+  //    the closed form of the speed and position, as m_brake_tick
+  //  - once at top speed it is the point m_brake_position
+  void plan_trapezoid(float top_speed, float final_speed) {
+    float v0 = m_sign * to_float(m_speed);
+    float p0 = m_sign * to_float(m_position);
+    float end = to_float(m_final_position);
+    float dt = g_loop_interval;
+    float dv = m_acceleration * dt;
+    float h = 0.5f / m_acceleration;
+    float ramp = ceilf(fabsf(top_speed - v0) / dv);
+    m_top_tick = ramp;
+    m_brake_tick = NEVER;
+    m_brake_position = m_sign * (end - h * fabsf(top_speed * top_speed - final_speed * final_speed));
+    float brake_tick = -1;
+    if (p0 + h * fabsf(v0 * v0 - final_speed * final_speed) > end) {
+      brake_tick = 0;
+    } else if (v0 < top_speed) {
+      // Below -vf the distance to go less the braking distance only grows,
+      // so the first chance is from there up to vf, where it shrinks
+      // linearly, and then above vf, where it shrinks as a quadratic.
+      // Slowing down to the top speed never brings the braking point
+      // closer, so then only tick 0 can brake before the top speed.
+      float below = (v0 < -final_speed) ? ceilf((-final_speed - v0) / dv) : 0;
+      float above = (v0 < final_speed) ? min(ceilf((final_speed - v0) / dv), ramp) : 0;
+      if (below < above) {
+        float c = p0 + h * (final_speed * final_speed - v0 * v0) - end;
+        float tick = max(floorf(-c / (0.5f * dv * dt)) + 1, below);
+        if (tick < above) {
+          brake_tick = tick;
+        }
+      }
+      if (brake_tick < 0) {
+        float a = dv * dt;
+        float b = 2 * v0 * dt + 0.5f * dv * dt;
+        float c = p0 + h * (v0 * v0 - final_speed * final_speed) - end;
+        float discriminant = b * b - 4 * a * c;
+        float tick = above;
+        if (discriminant >= 0) {
+          tick = max(floorf(0.5f * (sqrtf(discriminant) - b) / a) + 1, above);
+        }
+        if (tick < ramp) {
+          brake_tick = tick;
+        }
+      }
+    }
+    if (brake_tick >= 0) {
+      m_brake_tick = brake_tick;
+    }
+    m_planned_ticks = estimate_trapezoid_ticks(v0, p0, top_speed, final_speed, brake_tick);
+  }
+
+  // The length of the trapezoid to within a few ticks, for duration(). A
+  // brake_tick below zero means it brakes after reaching the top speed.
+  uint32_t estimate_trapezoid_ticks(float v0, float p0, float top_speed, float final_speed, float brake_tick) {
+    float dt = g_loop_interval;
+    float dv = m_acceleration * dt;
+    float end = to_float(m_final_position);
+    float ticks;
+    float speed;
+    float position;
+    if (brake_tick >= 0) {
+      ticks = brake_tick;
+      speed = v0 + ticks * dv;
+      position = p0 + dt * (ticks * v0 + dv * 0.5f * ticks * (ticks + 1));
+    } else {
+      ticks = m_top_tick;
+      speed = top_speed;
+      position = p0 + stepped_distance(v0, top_speed, ticks);
+      float brake_at = m_sign * to_float(m_brake_position);
+      if (position < brake_at) {
+        float cruise = ceilf((brake_at - position) / (top_speed * dt));
+        ticks += cruise;
+        position += cruise * top_speed * dt;
+      }
+    }
+    // Stepping the speed down covers less ground than braking smoothly,
+    // which is why a trapezoid usually creeps for a while at the end.
+    float target = (final_speed > 0) ? final_speed : PROFILE_CREEP_SPEED;
+    float steps = ceilf(fabsf(speed - target) / dv);
+    float braking = stepped_distance(speed, target, steps);
+    float left = end - position;
+    if (braking > left) {
+      // it gets to the end before reaching the target speed
+      float squared = speed * speed + 2 * ((target > speed) ? m_acceleration : -m_acceleration) * max(left, 0.0f);
+      return ticks + ceilf(fabsf(sqrtf(max(squared, 0.0f)) - speed) / dv);
+    }
+    return ticks + steps + max(ceilf((left - braking) / (target * dt)), 0.0f);
+  }
+
+  // Distance covered while the speed steps by dv a tick from one speed to
+  // another, taking 'ticks' ticks with the last step cut short.
+  float stepped_distance(float from, float to, float ticks) {
+    if (ticks < 1) {
+      return 0;
+    }
+    float step = m_acceleration * g_loop_interval;
+    if (to < from) {
+      step = -step;
+    }
+    return g_loop_interval * ((ticks - 1) * from + step * 0.5f * ticks * (ticks - 1) + to);
+  }
+
+  // Plans the whole S-curve in ticks: a ramp to the peak speed, a cruise
+  // and a ramp to the final speed. All the float work, including the square
+  // roots, is done here so that each tick costs about the same as a
+  // trapezoid. A profile that starts faster than its top speed ramps down
+  // to it first. Returns false if it would take too many ticks to count, or
+  // if the final speed cannot be reached in the distance, so that the
+  // trapezoid finishes at the distance instead.
+  bool plan_s_curve(float top_speed, float final_speed, float jerk) {
+    float start_speed = m_sign * to_float(m_speed);
+    float distance = to_float(m_final_position - fabsf(m_position));
+    // A retarget part way through a ramp first brings the acceleration back
+    // to zero at the jerk limit, then plans from where that leaves it. Over
+    // n ticks of an acceleration a (per tick) falling by a/n each tick, the
+    // speed changes by a(n - 1)/2 and the distance is n.v + a(n^2 - 1)/3
+    // ticks' worth of speed.
+    float acc = m_sign * to_float(m_ramp_acc);
+    float release_ticks = ceilf(fabsf(acc) * g_loop_frequency * g_loop_frequency / jerk);
+    if (release_ticks > 0) {
+      distance -= g_loop_interval * (release_ticks * start_speed + acc * (release_ticks * release_ticks - 1) / 3);
+      start_speed += acc * (release_ticks - 1) / 2;
+      if (distance < 0 || start_speed < 0) {
+        return false;
+      }
+    }
+    if (ramp_distance(start_speed, final_speed, jerk) > distance) {
+      return false;
+    }
+    // going straight from the start speed to the final speed always fits
+    float lowest_peak = (start_speed > top_speed) ? final_speed : max(start_speed, final_speed);
+    float peak = top_speed;
+    if (ramp_distance(start_speed, peak, jerk) + ramp_distance(peak, final_speed, jerk) > distance) {
+      // No room to reach top speed. If every ramp reached full acceleration
+      // the distance would be a quadratic in the peak speed, vp:
+      //   vp^2 + c.vp + k = 0 where c = a^2/j
+      // or, if both ramps slow down, a straight line:
+      //   (v0^2 - vf^2)/2a + (v0 + vf + 2vp).c/2a = distance
+      // Shorter ramps that never reach full acceleration take less time
+      // than that assumes, so this peak always fits, with a little cruise.
+      float c = m_acceleration * m_acceleration / jerk;
+      if (start_speed > top_speed) {
+        float braking = 0.5f * (start_speed * start_speed - final_speed * final_speed) / m_acceleration;
+        peak = 0.5f * ((distance - braking) / (0.5f * c / m_acceleration) - start_speed - final_speed);
+      } else {
+        float k = 0.5f * (c * (start_speed + final_speed) - start_speed * start_speed - final_speed * final_speed) - m_acceleration * distance;
+        float discriminant = c * c - 4 * k;
+        peak = (discriminant > 0) ? 0.5f * (sqrtf(discriminant) - c) : 0;
+      }
+      peak = min(max(peak, lowest_peak), top_speed);
+    }
+    if (peak < 1) {
+      return false;
+    }
+    // Whole ticks make the ramps a little longer than planned. Round the
+    // cruise up as well, then lower the peak so the distance comes out
+    // exact. Summed tick by tick, a ramp of n ticks covers
+    //   n.from + (n/2 + 1)(to - from) ticks' worth of speed
+    // so the distance is linear in the peak speed. Lowering the peak makes
+    // a ramp down to it steeper, so then the ramps are planned again for
+    // the lower peak, which only ever needs a tick or two more.
+    float ticks_of_travel = distance * g_loop_frequency;
+    float up_ticks;
+    float down_ticks;
+    float cruise_ticks;
+    float planned_peak = peak;
+    for (uint8_t pass = 0;; pass++) {
+      up_ticks = plan_ramp(m_up, start_speed, planned_peak, jerk);
+      down_ticks = plan_ramp(m_down, planned_peak, final_speed, jerk);
+      float ramps = up_ticks * start_speed + (up_ticks / 2 + 1) * (planned_peak - start_speed) + down_ticks * planned_peak + (down_ticks / 2 + 1) * (final_speed - planned_peak);
+      cruise_ticks = max(ceilf((ticks_of_travel - ramps) / planned_peak), 0.0f);
+      if (release_ticks + up_ticks + cruise_ticks + down_ticks > MAX_PROFILE_TICKS) {
+        return false;
+      }
+      peak = (ticks_of_travel - (up_ticks / 2 - 1) * start_speed - (down_ticks / 2 + 1) * final_speed) / ((up_ticks + down_ticks) / 2 + cruise_ticks);
+      // If even the lowest peak is too high, going straight from the start
+      // speed to the final speed is planned instead. If that still goes too
+      // far, the trapezoid will finish at the distance.
+      if (peak < lowest_peak && planned_peak <= lowest_peak) {
+        return false;
+      }
+      bool too_low = peak < lowest_peak;
+      peak = max(peak, lowest_peak);
+      bool steeper = start_speed > planned_peak && peak < planned_peak && !fits_ramp(m_up, start_speed, peak, jerk);
+      if (!too_low && !steeper) {
+        break;
+      }
+      if (pass == 3) {
+        return false;
+      }
+      planned_peak = peak;
+    }
+    set_ramp_speeds(m_up, start_speed, peak);
+    set_ramp_speeds(m_down, peak, final_speed);
+    m_cruise_ticks = cruise_ticks;
+    m_planned_ticks = release_ticks + up_ticks + cruise_ticks + down_ticks;
+    m_release_ticks = release_ticks;
+    m_release_step = (release_ticks > 0) ? real_t(m_sign * acc / release_ticks) : real_t(0);
+    m_release_speed = m_sign * start_speed;
+    return true;
+  }
+
+  // time and distance for a jerk limited change of speed with the
+  // acceleration rising to at most m_acceleration
+  float ramp_time(float from, float to, float jerk) {
+    float change = fabsf(to - from);
+    if (change * jerk >= m_acceleration * m_acceleration) {
+      return change / m_acceleration + m_acceleration / jerk;
+    }
+    return 2 * sqrtf(change / jerk);
+  }
+
+  float ramp_distance(float from, float to, float jerk) { return 0.5f * (from + to) * ramp_time(from, to, jerk); }
+
+  // Rounds the ramp up to whole ticks so that neither the acceleration nor
+  // the jerk limit is exceeded. Returns the number of ticks.
+  float plan_ramp(Ramp &ramp, float from, float to, float jerk) {
+    float change = fabsf(to - from);
+    ramp.jerk_ticks = 0;
+    ramp.total_ticks = 0;
+    if (change < 0.001f) {
+      return 0;
+    }
+    float jerk_time;
+    float hold_time = 0;
+    if (change * jerk >= m_acceleration * m_acceleration) {
+      jerk_time = m_acceleration / jerk;
+      hold_time = change / m_acceleration - jerk_time;
+    } else {
+      jerk_time = sqrtf(change / jerk);
+    }
+    float jerk_ticks = ceilf(jerk_time * g_loop_frequency);
+    float total_ticks = 2 * jerk_ticks + ceilf(hold_time * g_loop_frequency);
+    if (total_ticks > MAX_PROFILE_TICKS) {
+      return MAX_PROFILE_TICKS + 1;
+    }
+    ramp.jerk_ticks = (uint16_t)jerk_ticks;
+    ramp.total_ticks = (uint16_t)total_ticks;
+    return total_ticks;
+  }
+
+  // true if a ramp planned for one change of speed is long enough for another
+  bool fits_ramp(const Ramp &ramp, float from, float to, float jerk) {
+    Ramp check;
+    return plan_ramp(check, from, to, jerk) <= ramp.total_ticks && check.jerk_ticks <= ramp.jerk_ticks;
+  }
+
+  void set_ramp_speeds(Ramp &ramp, float from, float to) {
+    ramp.end_speed = m_sign * to;
+    ramp.jerk = 0;
+    if (ramp.jerk_ticks > 0) {
+      ramp.jerk = m_sign * (to - from) / ((float)ramp.jerk_ticks * (ramp.total_ticks - ramp.jerk_ticks));
+    }
+  }
+
+  // one tick of a planned ramp
+  void step_ramp(const Ramp &ramp) {
+    if (m_tick < ramp.jerk_ticks) {
+      m_ramp_acc += ramp.jerk;
+    } else if (m_tick >= (uint16_t)(ramp.total_ticks - ramp.jerk_ticks)) {
+      m_ramp_acc -= ramp.jerk;
+    }
+    m_speed += m_ramp_acc;
+    m_tick++;
+    if (m_tick == ramp.total_ticks) {
+      m_speed = ramp.end_speed; // remove the rounding
+      m_ramp_acc = 0;
+    }
+  }
+
+  // The phases switch on tick counts. Returns true until the final ramp
+  // is complete, and until then update() does not finish on distance, so
+  // the speed reaches the final speed smoothly instead of being cut off a
+  // few ticks early. After that it finishes on distance as usual and if the
+  // position has been adjusted so that the robot has further to go, it
+  // creeps the rest of the way as a trapezoid would.
+  bool follow_s_curve() {
+    if (m_state == CS_ACCELERATING) {
+      if (m_release_ticks > 0) {
+        m_ramp_acc -= m_release_step;
+        m_speed += m_ramp_acc;
+        if (--m_release_ticks == 0) {
+          m_speed = m_release_speed; // remove the rounding
+          m_ramp_acc = 0;
+        }
+        return true;
+      }
+      if (m_tick < m_up.total_ticks) {
+        step_ramp(m_up);
+        return true;
+      }
+      if (m_cruise_ticks > 0) {
+        m_speed = m_up.end_speed;
+        m_cruise_ticks--;
+        return true;
+      }
+      m_state = CS_BRAKING;
+      m_tick = 0;
+    }
+    if (m_tick < m_down.total_ticks) {
+      step_ramp(m_down);
+      return m_tick < m_down.total_ticks;
+    }
+    // within the acceleration limit, as the trapezoid does
+    if (m_final_speed == 0) {
+      m_target_speed = m_sign * PROFILE_CREEP_SPEED;
+    } else {
       m_target_speed = m_final_speed;
     }
+    approach_target_speed();
+    return false;
   }
 
-  private:
   volatile uint8_t m_state = CS_IDLE;
-  volatile float m_speed = 0;
-  volatile float m_position = 0;
+  volatile real_t m_speed = 0;
+  volatile real_t m_position = 0;
   int8_t m_sign = 1;
   float m_acceleration = 0;
-  float m_one_over_acc = 1;
-  float m_target_speed = 0;
-  float m_final_speed = 0;
-  float m_final_position = 0;
+  real_t m_delta_v = 0;
+  real_t m_target_speed = 0;
+  real_t m_final_speed = 0;
+  real_t m_final_position = 0;
+  real_t m_finish_position = 0;  // signed, finished once passed
+  uint32_t m_tick = 0;           // ticks since the profile started, until braking
+  uint32_t m_planned_ticks = 0;  // see duration()
+  // trapezoid plan, see plan_trapezoid()
+  uint32_t m_top_tick = 0;
+  uint32_t m_brake_tick = NEVER;
+  real_t m_brake_position = 0;
+  float m_jerk = 0;
+  // a move of the end waiting for the systick, see retarget()
+  volatile bool m_retarget = false;
+  float m_new_distance = 0;
+  float m_new_top_speed = 0;
+  float m_new_final_speed = 0;
+  uint16_t m_velocity_ticks = 0; // until a velocity mode profile times out
+  // arcs, see follow()
+  volatile bool m_following = false;
+  volatile uint8_t m_starts = 0; // counts starts, so a follower can tell
+  uint8_t m_leader_starts = 0;
+  Profile *m_leader = nullptr;
+  real_t m_ratio = 0;
+  // S-curve plan, see plan_s_curve()
+  bool m_s_curve = false;
+  uint16_t m_cruise_ticks = 0;
+  real_t m_ramp_acc = 0;
+  // after a retarget, see plan_s_curve()
+  uint16_t m_release_ticks = 0;
+  real_t m_release_step = 0;
+  real_t m_release_speed = 0;
+  Ramp m_up;
+  Ramp m_down;
 };
 
 #endif
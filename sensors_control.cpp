@@ -31,9 +31,15 @@
   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
   SOFTWARE.
 */
+#include "binary-protocol.h"
 #include "digitalWriteFast.h"
 #include "hardware_pins.h"
 #include "sensors_control.h"
+#include "serial-out.h"
+#include "write-number.h"
+#include "isr-profiler.h"
+#include "motors.h"
+#include "control-state.h"
 #include <Arduino.h>
 #include <util/atomic.h>
 #include <wiring_private.h>
@@ -63,7 +69,7 @@ volatile int gSensorA5_light;
 
 volatile int raw_BatteryVolts_adcValue;
 volatile float battery_voltage;
-volatile float g_battery_scale;
+volatile real_t g_battery_scale;
 
 volatile int Switch_ADC_value;
 const float batteryDividerRatio = 2.0f;
@@ -96,11 +102,31 @@ void analogueSetup()
  * Update battery voltage calculates the battery voltage and also
  * the scale factor used in the motor control
  *
+ * The ADC reading only changes now and then so the division is
+ * skipped unless there is a new value.
  */
 void update_battery_voltage()
 {
-    battery_voltage = raw_BatteryVolts_adcValue * (2.0 * 5.0 / 1024.0);
-    g_battery_scale = 255.0 / battery_voltage;
+    static int s_last_adc_value = -1;
+    static uint16_t s_last_pwm_top = 0;
+    int adc_value = raw_BatteryVolts_adcValue;
+    uint16_t pwm_top = g_motor_pwm_top;
+    if (adc_value == s_last_adc_value and pwm_top == s_last_pwm_top)
+    {
+        return;
+    }
+    s_last_adc_value = adc_value;
+    s_last_pwm_top = pwm_top;
+    battery_voltage = adc_value * (2.0 * 5.0 / 1024.0);
+#if CONTROL_FIXED_POINT
+    // pwm_top / battery_voltage is (pwm_top * 102.4) / adc_value so use an
+    // integer divide. It is shifted 2 bits less than Q16.16 to leave room
+    // for the 10 bit top, then the rest of the way after.
+    int32_t scale_numerator = (int32_t)(pwm_top * 1024L / (2 * 5)) << 14;
+    g_battery_scale = Fixed::from_raw(adc_value > 0 ? (scale_numerator / adc_value) << 2 : 0);
+#else
+    g_battery_scale = pwm_top / battery_voltage;
+#endif
 }
 
 /***
@@ -175,9 +201,15 @@ void sensors_control_setup()
 }
 
 static uint8_t sensor_phase = 0;
+static uint8_t sensor_cycle_start = 0;
 
 void start_sensor_cycle()
 {
+    if (bit_is_set(ADCSRA, ADIE))
+    {
+        profiler_adc_overrun(); // the last cycle never finished
+    }
+    sensor_cycle_start = profiler_now();
     sensor_phase = 0;     // sync up the start of the sensor sequence
     bitSet(ADCSRA, ADIE); // enable the ADC interrupt
     start_adc(0);         // begin a conversion to get things started
@@ -187,8 +219,7 @@ void print_hex2(int value)
 {
     value >>= 2; // get rid of button 2 bits - probably noise
     value = constrain(value, 0, 255);
-    Serial.print(value / 16, HEX);
-    Serial.print(value % 16, HEX);
+    print_hex(tx, value, 2);
 }
 
 void print_sensors_control(char mode)
@@ -207,51 +238,45 @@ void print_sensors_control(char mode)
     int a5_lit;
     const char comma = ',';
 
-    // read the sensors
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a0_dark = gSensorA0_dark;
-        a0_lit = gSensorA0_light;
-    }
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a1_dark = gSensorA1_dark;
-        a1_lit = gSensorA1_light;
+    // read the sensors, all from the same cycle
+    ControlState state;
+    read_control_state(state);
+    a0_dark = state.sensors_dark[0];
+    a0_lit = state.sensors_lit[0];
+    a1_dark = state.sensors_dark[1];
+    a1_lit = state.sensors_lit[1];
+    a2_dark = state.sensors_dark[2];
+    a2_lit = state.sensors_lit[2];
+    a3_dark = state.sensors_dark[3];
+    a3_lit = state.sensors_lit[3];
+    a4_dark = state.sensors_dark[4];
+    a4_lit = state.sensors_lit[4];
+    a5_dark = state.sensors_dark[5];
+    a5_lit = state.sensors_lit[5];
+
+    if (mode == 'b')
+    { // binary reply, the same differences as decimal but no line ending
+        binary_reply_int16(max(a0_lit - a0_dark, 0));
+        binary_reply_int16(max(a1_lit - a1_dark, 0));
+        binary_reply_int16(max(a2_lit - a2_dark, 0));
+        binary_reply_int16(max(a3_lit - a3_dark, 0));
+        binary_reply_int16(max(a4_lit - a4_dark, 0));
+        binary_reply_int16(max(a5_lit - a5_dark, 0));
+        return;
     }
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a2_dark = gSensorA2_dark;
-        a2_lit = gSensorA2_light;
-    }
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a3_dark = gSensorA3_dark;
-        a3_lit = gSensorA3_light;
-    }
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a4_dark = gSensorA4_dark;
-        a4_lit = gSensorA4_light;
-    }
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-    {
-        a5_dark = gSensorA5_dark;
-        a5_lit = gSensorA5_light;
-    }
-
-    if (mode == 'd')
+    else if (mode == 'd')
     { // the default is decimal differences
-        Serial.print(max(a0_lit - a0_dark, 0));
-        Serial.print(comma);
-        Serial.print(max(a1_lit - a1_dark, 0));
-        Serial.print(comma);
-        Serial.print(max(a2_lit - a2_dark, 0));
-        Serial.print(comma);
-        Serial.print(max(a3_lit - a3_dark, 0));
-        Serial.print(comma);
-        Serial.print(max(a4_lit - a4_dark, 0));
-        Serial.print(comma);
-        Serial.print(max(a5_lit - a5_dark, 0));
+        print_integer(tx, max(a0_lit - a0_dark, 0));
+        tx.print(comma);
+        print_integer(tx, max(a1_lit - a1_dark, 0));
+        tx.print(comma);
+        print_integer(tx, max(a2_lit - a2_dark, 0));
+        tx.print(comma);
+        print_integer(tx, max(a3_lit - a3_dark, 0));
+        tx.print(comma);
+        print_integer(tx, max(a4_lit - a4_dark, 0));
+        tx.print(comma);
+        print_integer(tx, max(a5_lit - a5_dark, 0));
     }
     else if (mode == 'h')
     { // display differences as hex values
@@ -264,33 +289,33 @@ void print_sensors_control(char mode)
     }
     else if (mode == 'r')
     { // display both dark and lit values
-        Serial.print(a0_dark);
-        Serial.print(comma);
-        Serial.print(a1_dark);
-        Serial.print(comma);
-        Serial.print(a2_dark);
-        Serial.print(comma);
-        Serial.print(a3_dark);
-        Serial.print(comma);
-        Serial.print(a4_dark);
-        Serial.print(comma);
-        Serial.print(a5_dark);
-        Serial.print(comma);
-        Serial.print(' ');
-        Serial.print(' ');
-        Serial.print(a0_lit);
-        Serial.print(comma);
-        Serial.print(a1_lit);
-        Serial.print(comma);
-        Serial.print(a2_lit);
-        Serial.print(comma);
-        Serial.print(a3_lit);
-        Serial.print(comma);
-        Serial.print(a4_lit);
-        Serial.print(comma);
-        Serial.print(a5_lit);
+        print_integer(tx, a0_dark);
+        tx.print(comma);
+        print_integer(tx, a1_dark);
+        tx.print(comma);
+        print_integer(tx, a2_dark);
+        tx.print(comma);
+        print_integer(tx, a3_dark);
+        tx.print(comma);
+        print_integer(tx, a4_dark);
+        tx.print(comma);
+        print_integer(tx, a5_dark);
+        tx.print(comma);
+        tx.print(' ');
+        tx.print(' ');
+        print_integer(tx, a0_lit);
+        tx.print(comma);
+        print_integer(tx, a1_lit);
+        tx.print(comma);
+        print_integer(tx, a2_lit);
+        tx.print(comma);
+        print_integer(tx, a3_lit);
+        tx.print(comma);
+        print_integer(tx, a4_lit);
+        tx.print(comma);
+        print_integer(tx, a5_lit);
     }
-    Serial.println();
+    tx.println();
 }
 
 /** @brief Sample all the sensor channels with and without the emitter on
@@ -312,6 +337,7 @@ void print_sensors_control(char mode)
 ISR(ADC_vect)
 {
     // digitalWriteFast(13, 1);
+    uint8_t start = profiler_now();
     switch (sensor_phase)
     {
         case 0:
@@ -387,10 +413,12 @@ ISR(ADC_vect)
                 digitalWriteFast(EMITTER, 0);
             }
             bitClear(ADCSRA, ADIE);
+            profiler_stage(PROFILE_ADC_CYCLE, sensor_cycle_start);
             break;
         default:
             break;
     }
+    profiler_adc_phase(sensor_phase, start);
     sensor_phase++;
     // digitalWriteFast(13, 0);
 }
@@ -35,6 +35,8 @@
 #ifndef SENSORS_CONTROL_H_
 #define SENSORS_CONTROL_H_
 
+#include "fixed-point.h"
+
 void start_sensor_cycle();
 void sensors_control_setup();
 void print_sensors_control(char mode);
@@ -44,7 +46,7 @@ void update_battery_voltage();
 // ADC channels
 extern volatile int raw_BatteryVolts_adcValue;
 extern volatile float battery_voltage;
-extern volatile float g_battery_scale; // adjusts PWM for voltage changes
+extern volatile real_t g_battery_scale; // adjusts PWM for voltage changes
 extern volatile int Switch_ADC_value;
 
 extern volatile int gSensorA0_dark;
@@ -0,0 +1,364 @@
+/*
+ * Serial output - buffered, non-blocking transmit lanes and output scheduler
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "serial-out.h"
+#include "interpreter.h"
+#include "write-number.h"
+#include <Arduino.h>
+
+/***
+ * The 64 byte HardwareSerial transmit buffer is too small to hold a typical
+ * burst of replies and, once it is full, Serial.print() waits until there is
+ * room. These lanes hold the overflow instead so loop() keeps running.
+ *
+ * The priority lane (TX_BUFFER_SIZE, see serial-out.h) is big enough for a
+ * full telemetry report. The bulk lane only needs to hold a line or two
+ * because jobs refill it as it drains.
+ */
+const uint8_t TX_BULK_BUFFER_SIZE = 96;
+const uint8_t TX_JOB_LINE_SPACE = 64; // room needed before a job is stepped
+
+static uint8_t tx_buffer[TX_BUFFER_SIZE];
+static uint8_t tx_ends[OUTPUT_LANE_ENDS_SIZE(TX_BUFFER_SIZE)];
+static uint8_t tx_bulk_buffer[TX_BULK_BUFFER_SIZE];
+static uint8_t tx_bulk_ends[OUTPUT_LANE_ENDS_SIZE(TX_BULK_BUFFER_SIZE)];
+
+OutputLane tx(tx_buffer, tx_ends, TX_BUFFER_SIZE);
+OutputLane tx_bulk(tx_bulk_buffer, tx_bulk_ends, TX_BULK_BUFFER_SIZE);
+
+static OutputJob s_job = 0;
+static uint8_t s_job_step;
+
+// true when the last byte sent from that lane ended a line or a frame
+static bool s_tx_at_line_start = true;
+static bool s_bulk_at_line_start = true;
+
+void OutputLane::record_drop(size_t length)
+{
+    if (m_dropped < 0xFFFF - length)
+    {
+        m_dropped += length;
+    }
+    else
+    {
+        m_dropped = 0xFFFF;
+    }
+}
+
+// caller has checked there is room
+void OutputLane::put(uint8_t c, bool line_end)
+{
+    uint8_t bit = 1 << (m_head & 7);
+    if (line_end)
+    {
+        m_ends[m_head >> 3] |= bit;
+    }
+    else
+    {
+        m_ends[m_head >> 3] &= ~bit;
+    }
+    m_buffer[m_head] = c;
+    if (++m_head == m_size)
+    {
+        m_head = 0;
+    }
+    if (++m_count > m_high_water)
+    {
+        m_high_water = m_count;
+    }
+    if (line_end)
+    {
+        m_line_length = 0;
+        m_line_sent = false;
+    }
+    else
+    {
+        m_line_length++;
+    }
+}
+
+/***
+ * Throws away the rest of the current line. If none of it has been read out
+ * yet, the part already in the buffer is taken back too, so the whole line
+ * is dropped. Otherwise the line is cut short but still gets its '\n', which
+ * there is always room for (see write()), so serial_out_service() is never
+ * left waiting for the end of a line that will not come.
+ */
+void OutputLane::drop_line()
+{
+    if (not m_line_sent)
+    {
+        m_head = (m_head + m_size - m_line_length) % m_size;
+        m_count -= m_line_length;
+        record_drop(m_line_length);
+        m_line_length = 0;
+        m_at_line_start = true;
+    }
+    m_dropping_line = true;
+}
+
+/***
+ * Every byte that does not end a line leaves room for one more byte, so the
+ * '\n' always fits once a line has started.
+ */
+size_t OutputLane::write(uint8_t c)
+{
+    bool line_end = c == '\n';
+    if (m_dropping_line)
+    {
+        if (line_end)
+        {
+            m_dropping_line = false;
+            if (m_line_length or m_line_sent)
+            {
+                put(c, true);
+                m_at_line_start = true;
+                return 1;
+            }
+        }
+        record_drop(1);
+        return 0;
+    }
+    uint8_t needed = line_end ? 1 : 2;
+    bool add_prefix = m_prefix and m_at_line_start;
+    if (add_prefix)
+    {
+        needed += strlen(m_prefix);
+    }
+    if (needed > m_size - m_count)
+    {
+        record_drop(1);
+        if (not line_end)
+        {
+            drop_line();
+        }
+        return 0;
+    }
+    if (add_prefix)
+    {
+        for (const char *p = m_prefix; *p; p++)
+        {
+            put(*p, false);
+        }
+    }
+    put(c, line_end);
+    m_at_line_start = line_end;
+    return 1;
+}
+
+// all or nothing, so a number is never cut short. If it does not fit, the
+// line it is part of is dropped.
+size_t OutputLane::write(const uint8_t *data, size_t length)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+    size_t needed = length;
+    if (data[length - 1] != '\n')
+    {
+        needed++; // room for the end of the line
+    }
+    if (m_prefix)
+    {
+        // allow for a prefix on every line that might start
+        uint8_t lines = 1;
+        for (size_t i = 0; i < length; i++)
+        {
+            lines += data[i] == '\n';
+        }
+        needed += lines * strlen(m_prefix);
+    }
+    if (not m_dropping_line and needed > (size_t)(m_size - m_count))
+    {
+        drop_line();
+    }
+    size_t written = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        written += write(data[i]);
+    }
+    return written;
+}
+
+/***
+ * A frame is never spliced into a text line, so one that comes while a line
+ * is unfinished is dropped. Frames and text are not mixed in practice.
+ */
+size_t OutputLane::write_frame(const uint8_t *frame, uint8_t length)
+{
+    if (length == 0 or m_line_length or m_line_sent or m_dropping_line or length > m_size - m_count)
+    {
+        record_drop(length);
+        return 0;
+    }
+    for (uint8_t i = 0; i < length; i++)
+    {
+        put(frame[i], i == length - 1);
+    }
+    return length;
+}
+
+uint8_t OutputLane::read(bool &line_end)
+{
+    line_end = m_ends[m_tail >> 3] & (1 << (m_tail & 7));
+    uint8_t c = m_buffer[m_tail];
+    if (++m_tail == m_size)
+    {
+        m_tail = 0;
+    }
+    if (m_line_length == m_count)
+    {
+        // the oldest byte left is part of the unfinished line
+        m_line_length--;
+        m_line_sent = true;
+    }
+    m_count--;
+    return c;
+}
+
+bool serial_out_start_job(OutputJob job)
+{
+    if (s_job)
+    {
+        return false;
+    }
+    s_job = job;
+    s_job_step = 0;
+    return true;
+}
+
+bool serial_out_job_running()
+{
+    return s_job != 0;
+}
+
+/***
+ * While flushing nothing more is written, so a line that has been left
+ * unfinished in one lane will never end. The other lane is then allowed to
+ * carry on rather than waiting for it forever.
+ */
+static void service_lanes(bool flushing)
+{
+    while (s_job and tx_bulk.space_for(TX_JOB_LINE_SPACE))
+    {
+        if (not s_job(s_job_step++))
+        {
+            s_job = 0;
+        }
+    }
+
+    int space = Serial.availableForWrite();
+    while (space > 0)
+    {
+        OutputLane *lane;
+        if (not s_bulk_at_line_start)
+        {
+            lane = &tx_bulk; // finish the line before anything else
+        }
+        else if (not tx.empty() or not s_tx_at_line_start)
+        {
+            lane = &tx;
+        }
+        else
+        {
+            lane = &tx_bulk;
+        }
+        if (lane->empty() and flushing)
+        {
+            lane = (lane == &tx) ? &tx_bulk : &tx;
+        }
+        if (lane->empty())
+        {
+            break;
+        }
+        bool line_end;
+        uint8_t c = lane->read(line_end);
+        Serial.write(c);
+        space--;
+        if (lane == &tx)
+        {
+            s_tx_at_line_start = line_end;
+        }
+        else
+        {
+            s_bulk_at_line_start = line_end;
+        }
+    }
+}
+
+void serial_out_service()
+{
+    service_lanes(false);
+}
+
+void serial_out_flush()
+{
+    while (s_job or not tx.empty() or not tx_bulk.empty())
+    {
+        service_lanes(true);
+    }
+    Serial.flush();
+}
+
+/** @brief  Output lane statistics.
+ *          O   print 'dropped,high-water' for the priority lane then the bulk lane
+ *          Oz  clear them
+ *  @return error code
+ */
+int8_t serial_out_command()
+{
+    char c = inputString[1];
+    if (c == 'z')
+    {
+        tx.clear_statistics();
+        tx_bulk.clear_statistics();
+    }
+    else if (c == 0)
+    {
+        print_unsigned(tx, tx.dropped());
+        tx.print(',');
+        print_unsigned(tx, tx.high_water());
+        tx.print(',');
+        print_unsigned(tx, tx_bulk.dropped());
+        tx.print(',');
+        print_unsigned(tx, tx_bulk.high_water());
+        tx.println();
+    }
+    else
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    return T_OK;
+}
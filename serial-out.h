@@ -0,0 +1,152 @@
+/*
+ * Serial output - buffered, non-blocking transmit lanes and output scheduler
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef SERIAL_OUT_H_
+#define SERIAL_OUT_H_
+
+#include <Arduino.h>
+
+/***
+ * All replies are written into one of two ring buffers instead of straight
+ * to Serial. Writes never wait. If there is not enough room for part of a
+ * line, the whole line is dropped and counted, rather than sending part of
+ * it. Only a line that has already started to go out to Serial is cut short,
+ * and even then it still gets its '\n'.
+ *
+ *  tx      - the priority lane. Command replies, errors and unsolicited '@'
+ *            messages.
+ *  tx_bulk - long dumps such as '$?', produced a line at a time by an
+ *            output job when there is room.
+ *
+ * Binary frames are written with write_frame(), whole or not at all. Inside
+ * a frame only its closing zero ends it, so a 0x0A data byte is not taken
+ * for the end of a line. Each lane keeps one bit per byte to mark where the
+ * lines and frames end.
+ *
+ * serial_out_service() moves bytes from the lanes into the Serial transmit
+ * buffer as space allows. Lanes only change at the end of a line (or binary
+ * frame) so the priority lane can overtake a dump without splitting lines.
+ */
+class OutputLane : public Print
+{
+public:
+    // ends needs a bit for each byte of the buffer, see OUTPUT_LANE_ENDS_SIZE
+    OutputLane(uint8_t *buffer, uint8_t *ends, uint8_t size) : m_buffer(buffer), m_ends(ends), m_size(size) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    using Print::write;
+    // an encoded binary frame, including its closing zero
+    size_t write_frame(const uint8_t *frame, uint8_t length);
+    int availableForWrite() override
+    {
+        return m_size - m_count;
+    }
+
+    bool space_for(uint8_t length) const
+    {
+        return m_size - m_count >= length;
+    }
+    bool empty() const
+    {
+        return m_count == 0;
+    }
+    // line_end is set if the byte ends a line or a frame
+    uint8_t read(bool &line_end);
+
+    uint16_t dropped() const
+    {
+        return m_dropped;
+    }
+    uint8_t high_water() const
+    {
+        return m_high_water;
+    }
+    void clear_statistics()
+    {
+        m_dropped = 0;
+        m_high_water = m_count;
+    }
+
+    // written at the start of every line until cleared with 0
+    void set_line_prefix(const char *prefix)
+    {
+        m_prefix = prefix;
+    }
+
+private:
+    void record_drop(size_t length);
+    void put(uint8_t c, bool line_end);
+    void drop_line();
+
+    uint8_t *m_buffer;
+    uint8_t *m_ends; // a bit for each byte, set if it ends a line or frame
+    uint8_t m_size;
+    uint8_t m_head = 0; // next byte written
+    uint8_t m_tail = 0; // next byte read
+    uint8_t m_count = 0;
+    uint8_t m_high_water = 0;
+    uint16_t m_dropped = 0;
+    bool m_at_line_start = true;
+    uint8_t m_line_length = 0; // bytes of the unfinished line still in the buffer
+    bool m_line_sent = false; // some of the unfinished line has been read out
+    bool m_dropping_line = false; // discarding the rest of the line
+    const char *m_prefix = 0;
+};
+
+#define OUTPUT_LANE_ENDS_SIZE(size) (((size) + 7) / 8)
+
+// the largest line or frame that can ever be written to tx in one go
+const uint8_t TX_BUFFER_SIZE = 160;
+
+extern OutputLane tx;
+extern OutputLane tx_bulk;
+
+/***
+ * An output job writes one piece of a long reply into tx_bulk each time it is
+ * called, with step counting up from zero. It returns false when finished.
+ * Only one job can run at a time.
+ */
+typedef bool (*OutputJob)(uint8_t step);
+bool serial_out_start_job(OutputJob job);
+bool serial_out_job_running();
+
+// called from loop(). Never waits.
+void serial_out_service();
+// waits until everything has been sent. Only for blocking test code.
+void serial_out_flush();
+
+int8_t serial_out_command();
+
+#endif /* SERIAL_OUT_H_ */
@@ -35,6 +35,9 @@
 */
 
 #include "settings.h"
+#include "motors.h"
+#include "serial-out.h"
+#include "write-number.h"
 #include "EEPROM.h"
 #include <Arduino.h>
 #include <util/crc16.h>
@@ -122,32 +125,71 @@ const int get_settings_count()
 }
 
 /***
- * utility function to send all the current settings values to the serial
- * device.
+ * Dumps of all the settings are too long to fit in the serial output
+ * buffers. Rather than waiting for them to drain, each dump runs as an output
+ * job which writes one setting at a time into the bulk lane when there is
+ * room. Commands keep running meanwhile and their replies go ahead of the
+ * rest of the dump.
  */
-void dump_settings(const int dp)
+static int s_dump_dp;
+
+static bool dump_settings_step(uint8_t step)
 {
-    Serial.println();
-    for (int i = 0; i < get_settings_count(); i++)
+    if (step == 0)
+    {
+        tx_bulk.println();
+        return true;
+    }
+    int i = step - 1;
+    if (i >= get_settings_count())
     {
-        Serial.print('$');
-        Serial.print(i);
-        Serial.print('=');
-        print_setting_value(i, dp);
-        Serial.println();
+        return false;
     }
+    print_setting(i, s_dump_dp, tx_bulk);
+    tx_bulk.println();
+    return true;
 }
 
-void dump_settings_detail(const int dp)
+static bool dump_settings_detail_step(uint8_t step)
 {
-    Serial.println();
-    for (int i = 0; i < get_settings_count(); i++)
+    if (step == 0)
+    {
+        tx_bulk.println();
+        return true;
+    }
+    int i = step - 1;
+    if (i >= get_settings_count())
     {
-        print_setting_details(i, dp);
-        Serial.println(';');
+        return false;
     }
+    print_setting_details(i, s_dump_dp, tx_bulk);
+    tx_bulk.println(';');
+    return true;
 }
 
+/***
+ * utility function to send all the current settings values to the serial
+ * device. Returns false if a dump is already in progress.
+ */
+bool dump_settings(const int dp)
+{
+    if (serial_out_job_running())
+    {
+        return false;
+    }
+    s_dump_dp = dp;
+    return serial_out_start_job(dump_settings_step);
+}
+
+bool dump_settings_detail(const int dp)
+{
+    if (serial_out_job_running())
+    {
+        return false;
+    }
+    s_dump_dp = dp;
+    return serial_out_start_job(dump_settings_detail_step);
+}
 
 void save_settings_to_eeprom()
 {
@@ -161,12 +203,13 @@ void load_settings_from_eeprom(bool verbose)
     if (eeprom_settings.revision == SETTINGS_REVISION)
     {
         settings = eeprom_settings;
+        apply_settings();
     }
     else
     {
         if (verbose)
         {
-            Serial.println(F("@Defaulting Params"));
+            tx.println(F("@Defaulting Params"));
             //dump_settings_detail();
         }
         restore_default_settings();
@@ -182,27 +225,27 @@ int get_setting_name(int i, char *s)
     strncpy_P(s, (char *)pgm_read_word(&(variableString[i])), 31);
     return 0;
 }
-void print_setting(int i, const int dp)
+void print_setting(int i, const int dp, Print &out)
 {
     if (i >= get_settings_count())
     {
         return;
     }
-    Serial.print('$');
-    Serial.print(i);
-    Serial.print('=');
-    print_setting_value(i, dp);
+    out.print('$');
+    print_integer(out, i);
+    out.print('=');
+    print_setting_value(i, dp, out);
 }
 
-void print_setting_details(const int i, const int dp)
+void print_setting_details(const int i, const int dp, Print &out)
 {
-    print_setting_type(i);
-    Serial.print(' ');
-    print_setting_name(i);
-    Serial.print(' ');
-    Serial.print('=');
-    Serial.print(' ');
-    print_setting_value(i, dp);
+    print_setting_type(i, out);
+    out.print(' ');
+    print_setting_name(i, out);
+    out.print(' ');
+    out.print('=');
+    out.print(' ');
+    print_setting_value(i, dp, out);
 }
 
 /***
@@ -211,7 +254,7 @@ void print_setting_details(const int i, const int dp)
  *
  * The variable is identified by its index, i.
  */
-void print_setting_value(const int i, const int dp)
+void print_setting_value(const int i, const int dp, Print &out)
 {
     if (i >= get_settings_count())
     {
@@ -221,26 +264,26 @@ void print_setting_value(const int i, const int dp)
     switch (pgm_read_byte_near(variableType + i))
     {
         case T_float:
-            Serial.print(*reinterpret_cast<float *>(ptr), dp);
+            print_float(out, *reinterpret_cast<float *>(ptr), dp);
             break;
         case T_bool:
-            Serial.print((*reinterpret_cast<bool *>(ptr)) ? 1 : 0);
+            out.print((*reinterpret_cast<bool *>(ptr)) ? '1' : '0');
             break;
         case T_uint32_t:
-            Serial.print(*reinterpret_cast<uint32_t *>(ptr));
+            print_unsigned(out, *reinterpret_cast<uint32_t *>(ptr));
             break;
         case T_uint16_t:
-            Serial.print(*reinterpret_cast<uint16_t *>(ptr));
+            print_unsigned(out, *reinterpret_cast<uint16_t *>(ptr));
             break;
         case T_int:
-            Serial.print(*reinterpret_cast<int *>(ptr));
+            print_integer(out, *reinterpret_cast<int *>(ptr));
             break;
         default:
-            Serial.println(F(" unknown type"));
+            out.println(F(" unknown type"));
     }
 }
 
-void print_setting_name(int i)
+void print_setting_name(int i, Print &out)
 {
     if (i >= get_settings_count())
     {
@@ -248,10 +291,10 @@ void print_setting_name(int i)
     }
     char buffer[32];
     strncpy_P(buffer, (char *)pgm_read_word(&(variableString[i])), 31); // Necessary casts and dereferencing,
-    Serial.print(buffer);
+    out.print(buffer);
 }
 
-void print_setting_type(const int i)
+void print_setting_type(const int i, Print &out)
 {
     if (i >= get_settings_count())
     {
@@ -260,23 +303,29 @@ void print_setting_type(const int i)
     switch (pgm_read_byte_near(variableType + i))
     {
         case T_float:
-            Serial.print(F("float"));
+            out.print(F("float"));
             break;
         case T_bool:
-            Serial.print(F("bool"));
+            out.print(F("bool"));
             break;
         case T_uint32_t:
-            Serial.print(F("uint32_t"));
+            out.print(F("uint32_t"));
             break;
         case T_uint16_t:
-            Serial.print(F("uint16_t"));
+            out.print(F("uint16_t"));
             break;
         case T_int: // fall through for ints
         default:
-            Serial.print(F("int"));
+            out.print(F("int"));
     }
 }
 
+void apply_settings()
+{
+    update_controller_gains();
+    update_motor_pwm();
+}
+
 /***
  * For convenience, settings can be written to by index number without
  * knowing the variable name. This can be useful when loading settings
@@ -308,6 +357,7 @@ int write_setting(const int i, const char *valueString)
         default:
             return -1;
     }
+    apply_settings();
     return 0;
 }
 
@@ -318,6 +368,7 @@ int write_setting(const int i, const char *valueString)
 int restore_default_settings()
 {
     memcpy_P(&settings, &defaults, sizeof(defaults));
+    apply_settings();
     save_settings_to_eeprom();
     return 0;
 }
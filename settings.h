@@ -52,6 +52,7 @@
 
 #include "robot_config.h"
 #include "misc_definitions.h"
+#include "serial-out.h"
 #include <stdint.h>
 
 /***
@@ -76,7 +77,7 @@
  *
  * NOTE: this means that any custom values in EEPROM will be lost.
  */
-const int SETTINGS_REVISION = 1010;
+const int SETTINGS_REVISION = 1013;
 
 /***
  * The address of the copy stored in EEPROM must be fixed. Although the size of
@@ -141,6 +142,16 @@ enum TypeName : uint8_t
     ACTION(int,   left_nominal,      LEFT_NOMINAL         ) \
     ACTION(int,   front_nominal,     FRONT_NOMINAL        ) \
     ACTION(int,   right_nominal,     RIGHT_NOMINAL        ) \
+    ACTION(float, fwdKI ,            FWD_KI               ) \
+    ACTION(float, rotKI ,            ROT_KI               ) \
+    ACTION(float, leftBiasFF,        BIAS_FF              ) \
+    ACTION(float, leftSpeedFF,       SPEED_FF             ) \
+    ACTION(float, leftAccFF,         0                    ) \
+    ACTION(float, rightBiasFF,       BIAS_FF              ) \
+    ACTION(float, rightSpeedFF,      SPEED_FF             ) \
+    ACTION(float, rightAccFF,        0                    ) \
+    ACTION(int,   motorPwmBits,      8                    ) \
+    ACTION(int,   motorPwmPrescale,  1                    ) \
 \
 
 
@@ -192,10 +203,10 @@ uint16_t hash16(const char *string);
 uint8_t crc8(uint8_t *data, unsigned int size);
 
 int get_setting_name(int i, char *s);
-void print_setting_name(int i);
-void print_setting_type(const int i);
-void print_setting_value(const int i, const int dp = DEFAULT_DECIMAL_PLACES);
-void print_setting_details(const int i, const int dp = DEFAULT_DECIMAL_PLACES);
+void print_setting_name(int i, Print &out = tx);
+void print_setting_type(const int i, Print &out = tx);
+void print_setting_value(const int i, const int dp = DEFAULT_DECIMAL_PLACES, Print &out = tx);
+void print_setting_details(const int i, const int dp = DEFAULT_DECIMAL_PLACES, Print &out = tx);
 
 // reading and writing EEPROM settings values and defaults
 int restore_default_settings();
@@ -203,11 +214,17 @@ void save_settings_to_eeprom();
 void load_settings_from_eeprom(bool verbose = false);
 
 // send one setting to the serial device in the form '$n=xxx'
-void print_setting(const int i, const int dp = DEFAULT_DECIMAL_PLACES);
+void print_setting(const int i, const int dp = DEFAULT_DECIMAL_PLACES, Print &out = tx);
 
-// send all to the serial device. sets displayed decimals
-void dump_settings(const int dp = DEFAULT_DECIMAL_PLACES);
-void dump_settings_detail(const int dp = DEFAULT_DECIMAL_PLACES);
+// send all to the serial device in the background. sets displayed decimals
+// returns false if a dump is already running
+bool dump_settings(const int dp = DEFAULT_DECIMAL_PLACES);
+bool dump_settings_detail(const int dp = DEFAULT_DECIMAL_PLACES);
+
+// Call after any change to the settings. The systick works from copies of
+// some of them (the controller gains and the motor PWM mode), and this
+// brings those up to date.
+void apply_settings();
 
 // write a value to a setting by index number
 int write_setting(const int i, const char *valueString);
@@ -222,6 +239,10 @@ int write_setting(const int i, const char *valueString);
 template <class T>
 int write_setting(const int i, const T value)
 {
+    if (i >= get_settings_count())
+    {
+        return -1;
+    }
     void *ptr = (void *)pgm_read_word_near(variablePointers + i);
     switch (pgm_read_byte_near(variableType + i))
     {
@@ -243,6 +264,7 @@ int write_setting(const int i, const T value)
         default:
             return -1;
     }
+    apply_settings();
     return 0;
 }
 #endif //SETTINGS_H
@@ -37,11 +37,70 @@
 #include "sensors_control.h"
 #include "distance-moved.h"
 #include "profile.h"
+#include "motion-queue.h"
 #include "motors.h"
+#include "telemetry.h"
+#include "control-state.h"
+#include "isr-profiler.h"
+#include "interpreter.h"
+#include "read-number.h"
+#include "write-number.h"
 #include <Arduino.h>
 #include <pins_arduino.h>
+#include <util/atomic.h>
 #include <wiring_private.h>
 
+uint16_t g_loop_frequency = LOOP_FREQUENCY;
+float g_loop_interval = LOOP_INTERVAL;
+fraction_t g_loop_dt = LOOP_INTERVAL;
+
+/***
+ * Timer 2 settings for each rate. 2kHz needs the smaller divisor because
+ * 16000000/128/2000 is not a whole number of counts.
+ */
+struct LoopRate
+{
+    uint16_t frequency;
+    uint8_t clock_select; // CS22:CS20
+    uint8_t top;          // OCR2A = (16000000/divisor/frequency)-1
+    uint8_t us_per_count;
+};
+
+static const LoopRate loop_rates[] PROGMEM = {
+    {500, 0b101, 249, 8},  // divide by 128 => timer clock = 125kHz
+    {1000, 0b101, 124, 8}, // divide by 128
+    {2000, 0b100, 124, 4}, // divide by 64 => timer clock = 250kHz
+};
+const int LOOP_RATE_COUNT = sizeof(loop_rates) / sizeof(loop_rates[0]);
+
+static bool find_loop_rate(uint16_t frequency, LoopRate &rate)
+{
+    for (int i = 0; i < LOOP_RATE_COUNT; i++)
+    {
+        memcpy_P(&rate, &loop_rates[i], sizeof(rate));
+        if (rate.frequency == frequency)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void apply_loop_rate(const LoopRate &rate)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        TCCR2B = (TCCR2B & ~0b111) | rate.clock_select;
+        OCR2A = rate.top;
+        TCNT2 = 0;
+        g_loop_frequency = rate.frequency;
+        g_loop_interval = 1.0f / rate.frequency;
+        g_loop_dt = g_loop_interval;
+    }
+    profiler_set_timebase(rate.top + 1, rate.us_per_count);
+    update_controller_gains();
+}
+
 /***
  * If you are interested in what all this does, the ATMega328P datasheet
  * has all the answers but it is not easy to follow until you have some
@@ -54,18 +113,75 @@ void setup_systick()
     bitSet(TCCR2A, WGM21);
     bitClear(TCCR2B, WGM22);
 
-    // set divisor to 128 => timer clock = 125kHz
-    bitSet(TCCR2B, CS22);
-    bitClear(TCCR2B, CS21);
-    bitSet(TCCR2B, CS20);
-
-    // set the timer frequency to 500Hz
-    OCR2A = 249;            // (16000000/128/500)-1 = 249
+    LoopRate rate;
+    if (not find_loop_rate(g_loop_frequency, rate))
+    {
+        find_loop_rate(500, rate);
+    }
+    apply_loop_rate(rate);
     bitSet(TIMSK2, OCIE2A); // enable the timer interrupt
 }
 
+int8_t set_loop_frequency(uint16_t frequency)
+{
+    LoopRate rate;
+    if (not find_loop_rate(frequency, rate))
+    {
+        return T_OUT_OF_RANGE;
+    }
+    if (frequency == g_loop_frequency)
+    {
+        return T_OK;
+    }
+    if (not forward.is_stopped() or not rotation.is_stopped())
+    {
+        return T_BUSY;
+    }
+    // the time per tick hardly changes with the rate, so the worst case
+    // so far is a fair guess at the load at the new rate
+    uint16_t tick_us;
+    uint16_t adc_us;
+    if (not profiler_max_us(PROFILE_SYSTICK, tick_us) or not profiler_max_us(PROFILE_ADC_CYCLE, adc_us))
+    {
+        return T_BUSY; // nothing measured since tz
+    }
+    uint16_t budget_us = 750000UL / frequency;
+    if (tick_us + adc_us > budget_us)
+    {
+        return T_OUT_OF_RANGE;
+    }
+    apply_loop_rate(rate);
+    return T_OK;
+}
+
+/** @brief  Systick (control loop) rate.
+ *          L       print the rate in Hz
+ *          Ln      change the rate to n Hz: 500, 1000 or 2000
+ *  @return error code
+ */
+int8_t loop_rate_command()
+{
+    if (inputString[1] == 0)
+    {
+        print_unsigned(tx, g_loop_frequency);
+        tx.println();
+        return T_OK;
+    }
+    uint8_t pos = 1;
+    int frequency;
+    if (not read_integer(inputString, &pos, &frequency) or inputString[pos] != 0)
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    if (frequency <= 0)
+    {
+        return T_OUT_OF_RANGE;
+    }
+    return set_loop_frequency(frequency);
+}
+
 /** @brief This is the systick event - an ISR connected to Timer 2
- * Running at 500Hz, the systick interrupt handles all the regular
+ * Running at 500Hz (or the rate set by L), the systick interrupt handles all the regular
  * control updates including
  *   - switch debounce
  *   - speed and odometry updates from the encoders
@@ -93,14 +209,22 @@ void setup_systick()
 ISR(TIMER2_COMPA_vect, ISR_NOBLOCK)
 {
     // digitalWriteFast(LED_BUILTIN, 1);
+    if (not profiler_systick_enter())
+    {
+        return;
+    }
+    uint8_t t = profiler_now();
     // grab the encoder values first because they will continue to change
     update_encoders();
+    t = profiler_stage(PROFILE_ENCODERS, t);
     update_battery_voltage();
+    t = profiler_stage(PROFILE_BATTERY, t);
 
-    battery_voltage = raw_BatteryVolts_adcValue * (2.0 * 5.0 / 1024.0);
-
+    update_motion_queues();
     forward.update();
+    t = profiler_stage(PROFILE_FORWARD, t);
     rotation.update();
+    t = profiler_stage(PROFILE_ROTATION, t);
 #ifdef STEERING_CONTROL_IN_LOW_LEVEL_MCU_ENABLE
     g_cross_track_error = update_wall_sensors();
     g_steering_adjustment = calculate_steering_adjustment(g_cross_track_error);
@@ -108,7 +232,13 @@ ISR(TIMER2_COMPA_vect, ISR_NOBLOCK)
 #else
     update_motor_controllers(g_steering_adjustment);
 #endif
+    profiler_stage(PROFILE_CONTROLLERS, t);
+    publish_control_state();
+    telemetry_capture();
 
+    // the counter was zero when the tick started, so this includes the ISR latency
+    profiler_stage(PROFILE_SYSTICK, 0);
+    profiler_systick_exit();
     // digitalWriteFast(LED_BUILTIN, 0);
     start_sensor_cycle();
     // NOTE: no code should follow this line;
@@ -35,6 +35,29 @@
 #ifndef _SYSTICK_H_
 #define _SYSTICK_H_
 
+#include "fixed-point.h"
+#include <stdint.h>
+
+/***
+ * The systick rate can be changed at run time with the L command. Anything
+ * that depends on the time step uses these rather than the LOOP_FREQUENCY
+ * and LOOP_INTERVAL constants, which only give the rate at reset.
+ */
+extern uint16_t g_loop_frequency; // Hz
+extern float g_loop_interval;     // seconds
+extern fraction_t g_loop_dt;      // g_loop_interval for the control chain
+
 void setup_systick();
 
+/***
+ * The supported rates are 500, 1000 and 2000Hz. A new rate is refused while
+ * a profile is running, or if the longest systick plus the longest ADC
+ * cycle measured so far would take more than 3/4 of the new period.
+ * @brief change the systick rate and everything derived from it
+ * @return T_OK, T_OUT_OF_RANGE or T_BUSY
+ */
+int8_t set_loop_frequency(uint16_t frequency);
+
+int8_t loop_rate_command();
+
 #endif
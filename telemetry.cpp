@@ -0,0 +1,448 @@
+/*
+ * Telemetry - periodic state reports streamed to the host without polling
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "telemetry.h"
+#include "binary-protocol.h"
+#include "distance-moved.h"
+#include "interpreter.h"
+#include "motors.h"
+#include "profile.h"
+#include "sensors_control.h"
+#include "serial-out.h"
+#include "write-number.h"
+#include <Arduino.h>
+#include <util/atomic.h>
+
+/***
+ * The host subscribes to a set of fields and a period in systick ticks.
+ * Every period the systick ISR copies the fields into a snapshot, so they
+ * all come from the same tick. loop() turns the snapshot into a line of
+ * text (or a binary frame in binary mode) and writes the whole line into the
+ * priority transmit lane once there is room for it, so command replies are
+ * never spliced into the middle of a report. Nothing here ever waits for the
+ * serial port.
+ *
+ * If the previous snapshot has not been sent when the next one is due, the
+ * new one is skipped and counted. The host can see the count with 'U?' and
+ * should choose fewer fields or a longer period.
+ *
+ * The 'g' command uses the same capture to get one snapshot of everything
+ * on demand.
+ */
+
+struct StateSnapshot
+{
+    uint32_t tick;
+    int16_t sensors[6];
+    int32_t left_total;
+    int32_t right_total;
+    float position;
+    float angle;
+    float battery;
+    float forward_speed;
+    float rotation_speed;
+    float left_volts;
+    float right_volts;
+};
+
+/***
+ * A text line with every field at its widest:
+ *    "@T:"                              3
+ *    tick        "4294967295"          10
+ *    6 sensors   ",-32768"             6 x 7
+ *    2 encoders  ",-2147483648"        2 x 12
+ *    5 floats    ",-4294967040.00"     5 x 15 (nan, inf and ovf are shorter)
+ *    "\r\n"                             2
+ * which is 156 bytes. The whole line goes into the priority lane in one
+ * write, so it has to fit in that too or it would never be sent.
+ */
+#define TELEMETRY_BUFFER_SIZE (3 + 10 + 6 * 7 + 2 * 12 + 5 * 15 + 2)
+static_assert(TELEMETRY_BUFFER_SIZE <= TX_BUFFER_SIZE, "TELEMETRY LINE TOO BIG FOR TX");
+
+static volatile uint8_t s_fields = 0; // nothing is sent while this is zero
+static volatile uint8_t s_period = 1;
+static uint8_t s_countdown = 1;
+static uint32_t s_tick_count = 0;
+
+static StateSnapshot s_snapshot;
+static volatile bool s_snapshot_ready = false;
+static volatile uint16_t s_skipped = 0;
+static uint16_t s_sent = 0;
+
+static StateSnapshot s_requested;
+static volatile bool s_state_requested = false;
+
+static uint8_t s_line[TELEMETRY_BUFFER_SIZE];
+static uint8_t s_line_length = 0; // non-zero while a line waits for tx space
+static bool s_line_is_frame = false;
+
+void telemetry_subscribe(uint8_t fields, uint8_t period)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s_fields = fields;
+        s_period = period;
+        s_countdown = period;
+        s_snapshot_ready = false;
+        s_skipped = 0;
+    }
+    s_sent = 0;
+}
+
+void telemetry_stop()
+{
+    s_fields = 0;
+}
+
+// only called from the systick ISR, so everything comes from the same tick
+static void capture_state(StateSnapshot &state)
+{
+    state.tick = s_tick_count;
+    state.sensors[0] = max(gSensorA0_light - gSensorA0_dark, 0);
+    state.sensors[1] = max(gSensorA1_light - gSensorA1_dark, 0);
+    state.sensors[2] = max(gSensorA2_light - gSensorA2_dark, 0);
+    state.sensors[3] = max(gSensorA3_light - gSensorA3_dark, 0);
+    state.sensors[4] = max(gSensorA4_light - gSensorA4_dark, 0);
+    state.sensors[5] = max(gSensorA5_light - gSensorA5_dark, 0);
+    state.left_total = encoder_left_total_isr();
+    state.right_total = encoder_right_total_isr();
+    state.position = to_float(robot_position_isr());
+    state.angle = to_float(robot_angle_isr());
+    state.battery = battery_voltage;
+    state.forward_speed = to_float(forward.speed_isr());
+    state.rotation_speed = to_float(rotation.speed_isr());
+    state.left_volts = to_float(g_left_motor_volts);
+    state.right_volts = to_float(g_right_motor_volts);
+}
+
+/***
+ * Runs inside the systick ISR after the encoders and controllers have been
+ * updated. Keep it short - it only copies values.
+ */
+void telemetry_capture()
+{
+    s_tick_count++;
+    if (s_state_requested)
+    {
+        capture_state(s_requested);
+        s_state_requested = false;
+    }
+    if (s_fields == 0 or --s_countdown != 0)
+    {
+        return;
+    }
+    s_countdown = s_period;
+    if (s_snapshot_ready)
+    {
+        s_skipped++;
+        return;
+    }
+    capture_state(s_snapshot);
+    s_snapshot_ready = true;
+}
+
+static void add_text(const char *text)
+{
+    while (*text and s_line_length < TELEMETRY_BUFFER_SIZE)
+    {
+        s_line[s_line_length++] = *text++;
+    }
+}
+
+static void add_long(int32_t value)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    write_integer(buffer, value);
+    add_text(",");
+    add_text(buffer);
+}
+
+static void add_float(float value)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    write_float(buffer, value, 2);
+    add_text(",");
+    add_text(buffer);
+}
+
+// line format: @T:tick,field,field...
+static void format_text(uint8_t fields)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    s_line_length = 0;
+    s_line_is_frame = false;
+    add_text("@T:");
+    write_unsigned(buffer, s_snapshot.tick);
+    add_text(buffer);
+    if (fields & TELEMETRY_SENSORS)
+    {
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            add_long(s_snapshot.sensors[i]);
+        }
+    }
+    if (fields & TELEMETRY_ENCODERS)
+    {
+        add_long(s_snapshot.left_total);
+        add_long(s_snapshot.right_total);
+    }
+    if (fields & TELEMETRY_POSE)
+    {
+        add_float(s_snapshot.position);
+        add_float(s_snapshot.angle);
+    }
+    if (fields & TELEMETRY_BATTERY)
+    {
+        add_float(s_snapshot.battery);
+    }
+    if (fields & TELEMETRY_SPEEDS)
+    {
+        add_float(s_snapshot.forward_speed);
+        add_float(s_snapshot.rotation_speed);
+    }
+    add_text("\r\n");
+}
+
+static uint8_t pack(uint8_t *frame, uint8_t length, const void *data, uint8_t size)
+{
+    memcpy(frame + length, data, size);
+    return length + size;
+}
+
+// frame format: 'U', 0, tick, fields... all packed as for binary replies
+static void format_binary(uint8_t fields)
+{
+    uint8_t frame[48];
+    uint8_t length = 0;
+    frame[length++] = 'U';
+    frame[length++] = T_OK;
+    length = pack(frame, length, &s_snapshot.tick, sizeof(s_snapshot.tick));
+    if (fields & TELEMETRY_SENSORS)
+    {
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            int16_t value = s_snapshot.sensors[i];
+            length = pack(frame, length, &value, sizeof(value));
+        }
+    }
+    if (fields & TELEMETRY_ENCODERS)
+    {
+        length = pack(frame, length, &s_snapshot.left_total, sizeof(int32_t));
+        length = pack(frame, length, &s_snapshot.right_total, sizeof(int32_t));
+    }
+    if (fields & TELEMETRY_POSE)
+    {
+        length = pack(frame, length, &s_snapshot.position, sizeof(float));
+        length = pack(frame, length, &s_snapshot.angle, sizeof(float));
+    }
+    if (fields & TELEMETRY_BATTERY)
+    {
+        int16_t millivolts = s_snapshot.battery * 1000;
+        length = pack(frame, length, &millivolts, sizeof(millivolts));
+    }
+    if (fields & TELEMETRY_SPEEDS)
+    {
+        length = pack(frame, length, &s_snapshot.forward_speed, sizeof(float));
+        length = pack(frame, length, &s_snapshot.rotation_speed, sizeof(float));
+    }
+    s_line_length = binary_encode_frame(frame, length, s_line);
+    s_line_is_frame = true;
+}
+
+/***
+ * Called every time round loop(). A formatted line is held until the
+ * priority lane has room for all of it.
+ */
+void telemetry_service()
+{
+    if (s_line_length == 0)
+    {
+        if (not s_snapshot_ready)
+        {
+            return;
+        }
+        // the ISR does not touch the snapshot until it is marked as used
+        uint8_t fields = s_fields;
+        if (binary_mode_enabled())
+        {
+            format_binary(fields);
+        }
+        else
+        {
+            format_text(fields);
+        }
+        s_snapshot_ready = false;
+    }
+    if (tx.space_for(s_line_length))
+    {
+        if (s_line_is_frame)
+        {
+            tx.write_frame(s_line, s_line_length);
+        }
+        else
+        {
+            tx.write(s_line, s_line_length);
+        }
+        s_line_length = 0;
+        s_sent++;
+    }
+}
+
+/** @brief  Subscribe to telemetry.
+ *          Um,n  send fields in bit mask m every n systick ticks
+ *          Uz    stop sending
+ *          U?    report the count of lines sent and snapshots skipped
+ *  @return error code
+ */
+int8_t telemetry_command()
+{
+    char c = inputString[1];
+    if (c == 'z')
+    {
+        telemetry_stop();
+        return T_OK;
+    }
+    if (c == '?')
+    {
+        uint16_t skipped;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            skipped = s_skipped;
+        }
+        if (binary_command_active())
+        {
+            binary_reply_int16(s_sent);
+            binary_reply_int16(skipped);
+        }
+        else
+        {
+            print_unsigned(tx, s_sent);
+            tx.print(',');
+            print_unsigned(tx, skipped);
+            tx.println();
+        }
+        return T_OK;
+    }
+    float args[2];
+    int8_t error = decode_float_arguments(1, args, 2);
+    if (error != T_OK)
+    {
+        return error;
+    }
+    int fields = args[0];
+    int period = args[1];
+    if (fields < 0 or fields > TELEMETRY_ALL or period < 1 or period > 255)
+    {
+        return T_OUT_OF_RANGE;
+    }
+    if (fields == 0)
+    {
+        telemetry_stop();
+    }
+    else
+    {
+        telemetry_subscribe(fields, period);
+    }
+    return T_OK;
+}
+
+/** @brief  Snapshot of the whole robot state, all from the same systick.
+ *          g   print tick,six sensors,left,right,position,angle,
+ *              forward speed,rotation speed,left volts,right volts,battery
+ *  Waits for the next systick (at most 2ms) to take the snapshot.
+ *  @return error code
+ */
+int8_t state_snapshot_command()
+{
+    if (inputString[1] != 0)
+    {
+        return T_UNEXPECTED_TOKEN;
+    }
+    s_state_requested = true;
+    uint32_t start = millis();
+    while (s_state_requested)
+    {
+        if (millis() - start > 10)
+        {
+            // the systick is not running
+            s_state_requested = false;
+            return T_BUSY;
+        }
+    }
+    const StateSnapshot &state = s_requested;
+    if (binary_command_active())
+    {
+        binary_reply_int32(state.tick);
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            binary_reply_int16(state.sensors[i]);
+        }
+        binary_reply_int32(state.left_total);
+        binary_reply_int32(state.right_total);
+        binary_reply_float(state.position);
+        binary_reply_float(state.angle);
+        binary_reply_float(state.forward_speed);
+        binary_reply_float(state.rotation_speed);
+        binary_reply_int16(state.left_volts * 1000);
+        binary_reply_int16(state.right_volts * 1000);
+        binary_reply_int16(state.battery * 1000);
+        return T_OK;
+    }
+    print_unsigned(tx, state.tick);
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        tx.print(',');
+        print_integer(tx, state.sensors[i]);
+    }
+    tx.print(',');
+    print_integer(tx, state.left_total);
+    tx.print(',');
+    print_integer(tx, state.right_total);
+    tx.print(',');
+    print_float(tx, state.position);
+    tx.print(',');
+    print_float(tx, state.angle);
+    tx.print(',');
+    print_float(tx, state.forward_speed);
+    tx.print(',');
+    print_float(tx, state.rotation_speed);
+    tx.print(',');
+    print_float(tx, state.left_volts);
+    tx.print(',');
+    print_float(tx, state.right_volts);
+    tx.print(',');
+    print_float(tx, state.battery, DEFAULT_DECIMAL_PLACES);
+    tx.println();
+    return T_OK;
+}
@@ -0,0 +1,66 @@
+/*
+ * Telemetry - periodic state reports streamed to the host without polling
+
+   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+   For more information see:
+       https://github.com/robzed/ukmarsey
+       https://ukmars.org/
+       https://github.com/ukmars/ukmarsbot
+       https://github.com/robzed/pizero_for_ukmarsbot
+
+  MIT License
+
+  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+/***
+ * Field selection bits for the 'U' command. Fields are always sent in this
+ * order, after the systick count.
+ */
+enum
+{
+    TELEMETRY_SENSORS = 0x01,  // six sensor light - dark differences
+    TELEMETRY_ENCODERS = 0x02, // left and right encoder totals
+    TELEMETRY_POSE = 0x04,     // robot position (mm) and angle (degrees)
+    TELEMETRY_BATTERY = 0x08,  // battery voltage
+    TELEMETRY_SPEEDS = 0x10,   // forward and rotation profile speeds
+    TELEMETRY_ALL = 0x1F
+};
+
+void telemetry_subscribe(uint8_t fields, uint8_t period);
+void telemetry_stop();
+
+// called from the systick ISR every tick
+void telemetry_capture();
+
+// called from loop(). Queues a report without waiting.
+void telemetry_service();
+
+int8_t telemetry_command();
+int8_t state_snapshot_command();
+
+#endif /* TELEMETRY_H_ */
@@ -31,11 +31,23 @@
   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
   SOFTWARE.
 */
+#include "binary-protocol.h"
+#include "control-state.h"
+#include "digitalWriteFast.h"
+#include "distance-moved.h"
+#include "fixed-point.h"
+#include "hardware_pins.h"
 #include "interpreter.h"
+#include "motion-queue.h"
+#include "motors.h"
+#include "profile.h"
 #include "read-number.h"
 #include "stopwatch.h"
 #include "switches.h"
+#include "serial-out.h"
+#include "settings.h"
 #include "tests.h"
+#include "write-number.h"
 
 int8_t cmd_test_runner()
 {
@@ -44,14 +56,41 @@ int8_t cmd_test_runner()
     test = decode_input_value(1);
     // int index = 1;
     // bool ok = read_integer(inputString, &index, &test);
-    Serial.print(F("TEST: "));
-    Serial.println(test);
-    Serial.println(sw.split());
+    tx.print(F("TEST: "));
+    tx.println(test);
+    tx.println(sw.split());
     switch (test)
     {
         case 1:
             test_controllers();
             break;
+        case 2:
+            test_binary_protocol_timing();
+            break;
+        case 3:
+            test_number_format_timing();
+            break;
+        case 4:
+            test_control_arithmetic_timing();
+            break;
+        case 5:
+            test_encoder_read_consistency();
+            break;
+        case 6:
+            test_motor_pwm_timing();
+            break;
+        case 7:
+            test_live_setting_writes();
+            break;
+        case 8:
+            test_arc_then_straight();
+            break;
+        case 9:
+            test_retarget_speed_steps();
+            break;
+        case 10:
+            test_longest_command();
+            break;
         default:
             break;
     }
@@ -63,20 +102,20 @@ int8_t cmd_test_runner()
 void log_controller_data()
 {
 #if 0
-    Serial.print(millis());
-    Serial.print(' ');
-    Serial.print(fwd_set_speed);
-    Serial.print(' ');
-    Serial.print(rot_set_speed);
-    Serial.print(' ');
-    Serial.print(robot_velocity);
-    Serial.print(' ');
-    Serial.print(robot_omega);
-    Serial.print(' ');
-    Serial.print(fwd_volts);
-    Serial.print(' ');
-    Serial.print(rot_volts); // placeholder for controller voltage
-    Serial.println();
+    tx.print(millis());
+    tx.print(' ');
+    tx.print(fwd_set_speed);
+    tx.print(' ');
+    tx.print(rot_set_speed);
+    tx.print(' ');
+    tx.print(robot_velocity);
+    tx.print(' ');
+    tx.print(robot_omega);
+    tx.print(' ');
+    tx.print(fwd_volts);
+    tx.print(' ');
+    tx.print(rot_volts); // placeholder for controller voltage
+    tx.println();
 #endif
 }
 
@@ -91,19 +130,19 @@ void test_controllers()
 {
 #if 0
     enable_controllers();
-    Serial.print(F("CONTROLLER TEST - "));
+    tx.print(F("CONTROLLER TEST - "));
     bool was_using_ff = flag_controllers_use_ff;
     if (readFunctionSwitch() & 0x01)
     {
         flag_controllers_use_ff = true;
-        Serial.println(F("WITH FF"));
+        tx.println(F("WITH FF"));
     }
     else
     {
         flag_controllers_use_ff = false;
-        Serial.println(F("NO FF"));
+        tx.println(F("NO FF"));
     }
-    Serial.println(F("Press the button when ready"));
+    tx.println(F("Press the button when ready"));
     wait_for_button_click();
     delay(100);
     uint32_t tick = millis() + 10;
@@ -154,3 +193,587 @@ void test_fwd_motion(){
 void test_rot_motion(){
 
 };
+
+/***
+ * Throws away everything written to it, so only the formatting is timed.
+ * Counts the bytes it is given.
+ */
+class NullPrint : public Print
+{
+public:
+    size_t write(uint8_t) override
+    {
+        written++;
+        return 1;
+    }
+    size_t write(const uint8_t *, size_t length) override
+    {
+        written += length;
+        return length;
+    }
+    uint16_t written = 0;
+};
+
+/***
+ * Compares the text and binary protocols for an 'S' round trip, the kind of
+ * command that binary is kept for. Only building the reply from six typical
+ * sensor readings is timed. Wire time is for 115200 baud with 10 bits per
+ * byte.
+ */
+void test_binary_protocol_timing()
+{
+    const int repeats = 100;
+    const int16_t sensors[6] = {512, 487, 1003, 35, 260, 998};
+
+    NullPrint out;
+    Stopwatch sw;
+    for (int i = 0; i < repeats; i++)
+    {
+        out.written = 0;
+        for (uint8_t j = 0; j < 6; j++)
+        {
+            if (j != 0)
+            {
+                out.print(',');
+            }
+            print_integer(out, sensors[j]);
+        }
+        out.println();
+    }
+    sw.stop();
+    uint32_t text_time = sw.elapsed_time() / repeats;
+    uint8_t text_bytes = 2 + out.written; // 'S' and LF, then the reply
+
+    uint8_t frame[BINARY_REPLY_SIZE];
+    uint8_t encoded[BINARY_REPLY_SIZE + 2];
+    uint8_t encoded_length = 0;
+    sw.start();
+    for (int i = 0; i < repeats; i++)
+    {
+        frame[0] = 'S';
+        frame[1] = T_OK;
+        memcpy(frame + 2, sensors, sizeof(sensors));
+        encoded_length = binary_encode_frame(frame, 2 + sizeof(sensors), encoded);
+    }
+    sw.stop();
+    uint32_t binary_time = sw.elapsed_time() / repeats;
+    uint8_t binary_bytes = 4 + encoded_length; // 'S' and its crc, encoded, then the reply
+
+    // bytes,reply us,wire us for the round trip in text then the same for binary
+    tx.print(text_bytes);
+    tx.print(',');
+    tx.print(text_time);
+    tx.print(',');
+    tx.println(text_bytes * 87);
+    tx.print(binary_bytes);
+    tx.print(',');
+    tx.print(binary_time);
+    tx.print(',');
+    tx.println(binary_bytes * 87);
+}
+
+static uint32_t cycles_per_call(const Stopwatch &sw, int calls)
+{
+    return sw.elapsed_time() * (F_CPU / 1000000) / calls;
+}
+
+/***
+ * Uses values like those in an 'ea' reply: encoder counts and a position and
+ * angle printed to two decimal places.
+ * Prints one line each for floats then longs: Print cycles,formatter cycles
+ */
+void test_number_format_timing()
+{
+    const int repeats = 50;
+    const float float_values[] = {0.0f, 1.25f, -12.5f, 123.45f, -1234.56f, 45.0f, -270.33f, 5000.01f};
+    const int32_t long_values[] = {0, 7, -42, 1520, -1498, 32767, 123456, -2147483647};
+    const int count = sizeof(float_values) / sizeof(float_values[0]);
+    NullPrint sink;
+
+    Stopwatch sw;
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sink.print(float_values[i], 2);
+        }
+    }
+    sw.stop();
+    uint32_t print_float_cycles = cycles_per_call(sw, repeats * count);
+
+    sw.start();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            print_float(sink, float_values[i], 2);
+        }
+    }
+    sw.stop();
+    uint32_t write_float_cycles = cycles_per_call(sw, repeats * count);
+
+    sw.start();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sink.print(long_values[i]);
+        }
+    }
+    sw.stop();
+    uint32_t print_long_cycles = cycles_per_call(sw, repeats * count);
+
+    sw.start();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            print_integer(sink, long_values[i]);
+        }
+    }
+    sw.stop();
+    uint32_t write_long_cycles = cycles_per_call(sw, repeats * count);
+
+    print_unsigned(tx, print_float_cycles);
+    tx.print(',');
+    print_unsigned(tx, write_float_cycles);
+    tx.println();
+    print_unsigned(tx, print_long_cycles);
+    tx.print(',');
+    print_unsigned(tx, write_long_cycles);
+    tx.println();
+}
+
+/***
+ * One tick of the forward control arithmetic: a profile step, the encoder
+ * count scaled to mm and the PD controller with feedforward down to a PWM
+ * value. Written once for both number types so that they do the same work.
+ */
+template <typename REAL, typename FRACTION>
+struct ControlArithmetic
+{
+    REAL speed = 0;
+    REAL position = 0;
+    REAL error = 0;
+    REAL old_error = 0;
+
+    int step(int encoder_delta)
+    {
+        const REAL target_speed = 1000.0f;
+        const REAL delta_v = 4.0f;
+        const REAL mm_per_count = 0.4363f;
+        const REAL kp = 0.5f;
+        const REAL kd = 1.0f;
+        const REAL ff = SPEED_FF;
+        const REAL volts_limit = MAX_MOTOR_VOLTS;
+        const REAL battery_scale = 255.0f / 8.0f;
+
+        if (speed < target_speed)
+        {
+            speed += delta_v;
+        }
+        REAL increment = speed * FRACTION(LOOP_INTERVAL);
+        position += increment;
+        error += increment - encoder_delta * mm_per_count;
+        REAL diff = error - old_error;
+        old_error = error;
+        REAL volts = kp * error + kd * diff + ff * speed;
+        volts = constrain(volts, -volts_limit, volts_limit);
+        return to_int(volts * battery_scale);
+    }
+};
+
+// counts for wheels that follow the profile about 1% behind
+static int32_t simulated_encoder_total(int32_t tick)
+{
+    // profile position in um, with 440um per count rather than 436
+    int32_t position = tick <= 250 ? 4 * tick * (tick + 1) : 251000L + (tick - 250) * 2000L;
+    return position / 440;
+}
+
+static int simulated_encoder_counts(int tick)
+{
+    return simulated_encoder_total(tick + 1) - simulated_encoder_total(tick);
+}
+
+/***
+ * Times the control arithmetic in float and in Fixed, whatever the build
+ * setting of CONTROL_FIXED_POINT, then runs both side by side to compare.
+ * Prints cycles per tick for float,fixed then the largest PWM difference
+ * and the difference in final profile position in mm.
+ */
+void test_control_arithmetic_timing()
+{
+    const int ticks = 500;
+    volatile int pwm;
+
+    ControlArithmetic<float, float> float_chain;
+    Stopwatch sw;
+    for (int i = 0; i < ticks; i++)
+    {
+        pwm = float_chain.step(simulated_encoder_counts(i));
+    }
+    sw.stop();
+    uint32_t float_cycles = cycles_per_call(sw, ticks);
+
+    ControlArithmetic<Fixed, Fraction> fixed_chain;
+    sw.start();
+    for (int i = 0; i < ticks; i++)
+    {
+        pwm = fixed_chain.step(simulated_encoder_counts(i));
+    }
+    sw.stop();
+    uint32_t fixed_cycles = cycles_per_call(sw, ticks);
+
+    float_chain = ControlArithmetic<float, float>();
+    fixed_chain = ControlArithmetic<Fixed, Fraction>();
+    int worst = 0;
+    for (int i = 0; i < ticks; i++)
+    {
+        int difference = float_chain.step(simulated_encoder_counts(i)) - fixed_chain.step(simulated_encoder_counts(i));
+        worst = max(worst, abs(difference));
+    }
+    (void)pwm;
+
+    print_unsigned(tx, float_cycles);
+    tx.print(',');
+    print_unsigned(tx, fixed_cycles);
+    tx.println();
+    print_integer(tx, worst);
+    tx.print(',');
+    print_float(tx, fixed_chain.position.to_float() - float_chain.position, 4);
+    tx.println();
+}
+
+/***
+ * Drives the encoder totals back and forth across 0x0000FFFF / 0x00010000,
+ * where all four bytes change at once, while loop() reads them as fast as
+ * it can. A torn read shows up as a value that is neither, or as wheels
+ * that no longer cancel. The raw totals are read with no protection as
+ * well, to show that the test does catch the systick mid read.
+ *
+ * The wheels must not turn. Leaves the controllers off and the encoders
+ * zeroed.
+ *
+ * Prints reads, read retries, torn published reads, torn raw reads.
+ */
+void test_encoder_read_consistency()
+{
+    const int32_t low = 0xFFFF;
+    const int32_t high = 0x10000;
+
+    disable_motor_controllers();
+    stop_motors();
+    reset_encoders();
+    // leave time for a tick between each step so the counters never overflow
+    inject_encoder_counts(32767, -32767);
+    delay(5);
+    inject_encoder_counts(32767, -32767);
+    delay(5);
+    inject_encoder_counts(1, -1);
+    delay(5);
+
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    uint32_t raw_torn = 0;
+    uint16_t retries = control_state_retries();
+    int step = 1;
+    Stopwatch sw;
+    while (sw.split() < 2 * ONE_SECOND)
+    {
+        int32_t left;
+        int32_t right;
+        encoder_totals(left, right);
+        if ((left != low and left != high) or right != -left)
+        {
+            torn++;
+        }
+        int32_t raw = encoder_left_total_isr();
+        if (raw != low and raw != high)
+        {
+            raw_torn++;
+        }
+        reads++;
+        // the systick sees +1 or -1 at most, so the totals only ever flip
+        inject_encoder_counts(step, -step);
+        step = -step;
+    }
+    retries = control_state_retries() - retries;
+    reset_encoders();
+    reset_motor_controllers();
+
+    print_unsigned(tx, reads);
+    tx.print(',');
+    print_unsigned(tx, retries);
+    tx.print(',');
+    print_unsigned(tx, torn);
+    tx.print(',');
+    print_unsigned(tx, raw_torn);
+    tx.println();
+}
+
+/***
+ * Times set_left_motor_pwm() against the analogWrite() it replaced. A duty
+ * of 1 is too little to turn the motor. Leaves the controllers off and the
+ * motors stopped.
+ *
+ * Prints cycles per call for analogWrite,set_left_motor_pwm then 1 if the
+ * direct Timer1 path is in use.
+ */
+void test_motor_pwm_timing()
+{
+    const int calls = 1000;
+    disable_motor_controllers();
+    stop_motors();
+
+    Stopwatch sw;
+    for (int i = 0; i < calls; i++)
+    {
+        digitalWriteFast(MOTOR_LEFT_DIR, 0);
+        analogWrite(MOTOR_LEFT_PWM, 1);
+    }
+    sw.stop();
+    uint32_t library_cycles = cycles_per_call(sw, calls);
+
+    sw.start();
+    for (int i = 0; i < calls; i++)
+    {
+        set_left_motor_pwm(MOTOR_LEFT_POLARITY);
+    }
+    sw.stop();
+    uint32_t direct_cycles = cycles_per_call(sw, calls);
+    stop_motors();
+
+    print_unsigned(tx, library_cycles);
+    tx.print(',');
+    print_unsigned(tx, direct_cycles);
+    tx.println();
+    print_integer(tx, motor_pwm_is_direct());
+    tx.println();
+}
+
+/***
+ * Two runs of the controllers, as the systick would do them, with a forward
+ * profile accelerating from rest in between so that the acceleration
+ * feedforward has a real change of speed to work on. The first run only
+ * primes the controllers. Interrupts stay off throughout so that the
+ * systick cannot run the controllers as well, and the motors are only
+ * driven for the few microseconds it takes.
+ */
+static float left_controller_output()
+{
+    float volts;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        forward.reset();
+        rotation.reset();
+        forward.start(1000, 500, 0, 2000);
+        forward.update();
+        reset_motor_controllers();
+        enable_motor_controllers();
+        update_motor_controllers(0);
+        forward.update();
+        update_motor_controllers(0);
+        volts = to_float(g_left_motor_volts);
+        disable_motor_controllers();
+        stop_motors();
+        forward.reset();
+    }
+    return volts;
+}
+
+// the index '$n=' uses for the setting at setting, or -1
+static int setting_index(const void *setting)
+{
+    for (int i = 0; i < get_settings_count(); i++)
+    {
+        if ((const void *)pgm_read_word_near(variablePointers + i) == setting)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/***
+ * Writes each of the controller and feedforward settings the way '$n=' does
+ * and checks that the next controller output changes, then puts the
+ * setting back. Leaves the controllers off and the motors stopped.
+ *
+ * Prints one line per setting: index,1 if it took effect or 0 if not.
+ */
+void test_live_setting_writes()
+{
+    float *values[] = {&settings.fwdKP, &settings.fwdKD, &settings.fwdKI,
+                       &settings.leftBiasFF, &settings.leftSpeedFF, &settings.leftAccFF};
+    disable_motor_controllers();
+    for (uint8_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        int index = setting_index(values[i]);
+        float original = *values[i];
+        float before = left_controller_output();
+        write_setting(index, original + 0.5f);
+        float after = left_controller_output();
+        write_setting(index, original);
+        print_integer(tx, index);
+        tx.print(',');
+        print_unsigned(tx, (after != before) ? 1 : 0);
+        tx.println();
+    }
+}
+
+/***
+ * Waits for the forward profile to finish, with the systick running it,
+ * and returns the largest rotation speed seen on the way.
+ */
+static float wait_for_forward_profile()
+{
+    float fastest = 0;
+    Stopwatch sw;
+    while (not forward.is_stopped() and sw.split() < 5 * ONE_SECOND)
+    {
+        serial_out_service();
+        ControlState state;
+        read_control_state(state);
+        fastest = max(fastest, fabsf(to_float(state.rotation_speed)));
+    }
+    return fastest;
+}
+
+/***
+ * Runs the arc 'a180,90,500,0,2000' and then the straight 'p200,500,0,2000'
+ * with the controllers off, so the robot does not move, and checks that the
+ * rotation profile stops following the forward profile once the straight
+ * starts. Leaves the controllers off and the profiles reset.
+ *
+ * Prints the angle of the arc, then the angle turned and the largest
+ * rotation speed during the straight. Both of those should be close to 0.
+ */
+void test_arc_then_straight()
+{
+    disable_motor_controllers();
+    stop_motors();
+    forward_queue.clear();
+    rotation_queue.clear();
+    forward.reset();
+    rotation.reset();
+    forward.start(180, 500, 0, 2000);
+    rotation.follow(forward, 90.0f / 180);
+    wait_for_forward_profile();
+    ControlState state;
+    read_control_state(state);
+    float arc_angle = to_float(state.rotation_position);
+    forward.start(200, 500, 0, 2000);
+    float fastest = wait_for_forward_profile();
+    read_control_state(state);
+    print_float(tx, arc_angle, 1);
+    tx.print(',');
+    print_float(tx, to_float(state.rotation_position) - arc_angle, 2);
+    tx.print(',');
+    print_float(tx, fastest, 1);
+    tx.println();
+    forward.reset();
+    rotation.reset();
+}
+
+/***
+ * Retargets a jerk limited p move at several points along it, nearer,
+ * further and much further, keeping its top speed or lowering it below the
+ * speed it has reached, and checks that the speed never changes by more
+ * in one tick than the acceleration allows. It uses a Profile of its own,
+ * stepped here rather than in the systick, so the robot does not move.
+ *
+ * Prints the number of retargets, how many of them broke the limit (should
+ * be 0), the largest change of speed in a tick as a fraction of the limit,
+ * and the furthest any move ended beyond both its new end and the point
+ * where braking at once would have stopped it, in mm.
+ */
+void test_retarget_speed_steps()
+{
+    const float acceleration = 3000;
+    const float distances[] = {300, 650};
+    const float new_ends[] = {0.8f, 1.1f, 1.5f};
+    const uint16_t retarget_ticks[] = {20, 60, 120, 200};
+    const float new_top_speeds[] = {1000, 400};
+    float limit = acceleration * g_loop_interval;
+    uint8_t retargets = 0;
+    uint8_t broken = 0;
+    float largest = 0;
+    float furthest = 0;
+    for (float distance : distances)
+    {
+        for (float new_end : new_ends)
+        {
+            for (uint16_t retarget_tick : retarget_ticks)
+            {
+                for (float new_top_speed : new_top_speeds)
+                {
+                    Profile profile;
+                    profile.start(distance, 1000, 0, acceleration, 50000);
+                    float speed = 0;
+                    float step = 0;
+                    for (uint16_t tick = 0; tick < retarget_tick and not profile.is_stopped(); tick++)
+                    {
+                        profile.update();
+                        float next = to_float(profile.speed_isr());
+                        step = max(step, fabsf(next - speed));
+                        speed = next;
+                    }
+                    float end = distance * new_end;
+                    if (not profile.retarget(end, new_top_speed, 0))
+                    {
+                        continue;
+                    }
+                    float stopping_point = to_float(profile.position_isr()) + speed * speed / (2 * acceleration);
+                    for (uint16_t tick = 0; tick < 10000 and not profile.is_stopped(); tick++)
+                    {
+                        profile.update();
+                        float next = to_float(profile.speed_isr());
+                        step = max(step, fabsf(next - speed));
+                        speed = next;
+                    }
+                    retargets++;
+                    broken += step > limit * 1.01f;
+                    largest = max(largest, step / limit);
+                    furthest = max(furthest, to_float(profile.position_isr()) - max(end, stopping_point));
+                }
+            }
+        }
+    }
+    print_unsigned(tx, retargets);
+    tx.print(',');
+    print_unsigned(tx, broken);
+    tx.print(',');
+    print_float(tx, largest, 2);
+    tx.print(',');
+    print_float(tx, furthest, 1);
+    tx.println();
+}
+
+/***
+ * The longest command in the README is a queued arc with all six arguments.
+ * It is copied into the input buffer as the interpreter would receive it,
+ * after any tag, and its arguments are read back.
+ */
+void test_longest_command()
+{
+    const char command[] = "a+-180.25,-90.25,1000.5,500.25,5000.5,50000";
+    const float expected[] = {-180.25f, -90.25f, 1000.5f, 500.25f, 5000.5f, 50000.0f};
+    static_assert(sizeof(command) == MAX_INPUT_SIZE, "the test command should fill the input buffer");
+    strcpy(inputString, command);
+    inputIndex = strlen(command);
+    float args[6];
+    int8_t error = decode_float_arguments(2, args, 5, 1);
+    uint8_t matched = 0;
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        if (fabsf(args[i] - expected[i]) < 0.01f)
+        {
+            matched++;
+        }
+    }
+    print_integer(tx, error);
+    tx.print(',');
+    print_unsigned(tx, matched);
+    tx.println();
+}
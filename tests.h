@@ -79,4 +79,58 @@ void test_rot_speed_control_constants();
 void test_fwd_motion();
 void test_rot_motion();
 
+/***
+ * Times building an 'S' reply and counts the bytes on the wire for the text
+ * and binary protocols.
+ */
+void test_binary_protocol_timing();
+
+/***
+ * Compares Print::print() with the write-number formatters in CPU cycles per
+ * number.
+ */
+void test_number_format_timing();
+
+/***
+ * Compares one tick of the control arithmetic in float and Q16.16 fixed
+ * point, in CPU cycles, and reports how far apart the two results end up.
+ */
+void test_control_arithmetic_timing();
+
+/***
+ * Checks that loop() never sees a half updated 32 bit encoder total while
+ * the systick is changing all four bytes of it.
+ */
+void test_encoder_read_consistency();
+
+/***
+ * Compares the cost of setting a motor PWM through analogWrite() and
+ * through set_left_motor_pwm(), in CPU cycles per call.
+ */
+void test_motor_pwm_timing();
+
+/***
+ * Checks that writing a controller or feedforward setting by index, as
+ * '$n=' does, changes the very next controller output.
+ */
+void test_live_setting_writes();
+
+/***
+ * Checks that a straight move started after an arc does not turn, because
+ * the rotation profile stops following the forward one.
+ */
+void test_arc_then_straight();
+
+/***
+ * Checks that retargeting a jerk limited profile part way along never
+ * changes the speed faster than the acceleration limit.
+ */
+void test_retarget_speed_steps();
+
+/***
+ * Checks that the longest documented command fits the input buffer and
+ * that all its arguments are read.
+ */
+void test_longest_command();
+
 #endif
@@ -39,6 +39,9 @@
 #include "distance-moved.h"
 #include "systick.h"
 #include "interpreter.h"
+#include "telemetry.h"
+#include "isr-profiler.h"
+#include "serial-out.h"
 #include "hardware_pins.h"
 #include <Arduino.h>
 
@@ -63,4 +66,7 @@ void setup()
 void loop()
 {
     interpreter();
+    telemetry_service();
+    profiler_warning_service();
+    serial_out_service();
 }
@@ -0,0 +1,214 @@
+/*
+ * File: write-number.cpp
+ * Project: ukmarsey
+ * File Created: Friday, 16th October 2026 10:12:05 am
+ *
+ *   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+ *   For more information see:
+ *       https://github.com/robzed/ukmarsey
+ *       https://ukmars.org/
+ *       https://github.com/ukmars/ukmarsbot
+ *       https://github.com/robzed/pizero_for_ukmarsbot
+ *
+ *  MIT License
+ *
+ *  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+ *  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+*/
+
+#include "write-number.h"
+/////////////////////////////////////////////////////////////////////////////
+
+// powers_of_ten[i] is 10^(9 - i)
+static const uint32_t powers_of_ten[] PROGMEM = {
+    1000000000UL,
+    100000000UL,
+    10000000UL,
+    1000000UL,
+    100000UL,
+    10000UL,
+    1000UL,
+    100UL,
+    10UL,
+    1UL,
+};
+
+// largest float that Print will print, above this it gives 'ovf'
+const float MAX_FLOAT = 4294967040.0f;
+
+static uint8_t write_text(char *buffer, const char *text)
+{
+    uint8_t length = strlen(text);
+    memcpy(buffer, text, length + 1);
+    return length;
+}
+
+/***
+ * Writes value with leading zeros to make at least min_digits digits.
+ * At most nine subtractions per digit. Leading zeros cost one compare each.
+ * RETURNS a pointer to the character after the last digit. Not terminated.
+ */
+static char *write_digits(char *ptr, uint32_t value, uint8_t min_digits)
+{
+    bool started = false;
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        uint32_t power = pgm_read_dword(powers_of_ten + i);
+        char digit = '0';
+        while (value >= power)
+        {
+            value -= power;
+            digit++;
+        }
+        if (started or digit != '0' or 10 - i <= min_digits)
+        {
+            *ptr++ = digit;
+            started = true;
+        }
+    }
+    *ptr++ = '0' + value;
+    return ptr;
+}
+
+uint8_t write_unsigned(char *buffer, uint32_t value)
+{
+    char *ptr = write_digits(buffer, value, 1);
+    *ptr = 0;
+    return ptr - buffer;
+}
+
+uint8_t write_integer(char *buffer, int32_t value)
+{
+    if (value < 0)
+    {
+        buffer[0] = '-';
+        return 1 + write_unsigned(buffer + 1, -(uint32_t)value);
+    }
+    return write_unsigned(buffer, value);
+}
+
+uint8_t write_fixed(char *buffer, int32_t value, uint8_t dp)
+{
+    char *ptr = buffer;
+    uint32_t magnitude = value;
+    if (value < 0)
+    {
+        *ptr++ = '-';
+        magnitude = -magnitude;
+    }
+    // all the digits, then move the decimals along to make room for the point
+    ptr = write_digits(ptr, magnitude, dp + 1);
+    if (dp > 0)
+    {
+        memmove(ptr - dp + 1, ptr - dp, dp);
+        ptr[-dp] = '.';
+        ptr++;
+    }
+    *ptr = 0;
+    return ptr - buffer;
+}
+
+/***
+ * The whole number part is converted straight to a long so it is exact.
+ * Only the fractional part is scaled, with one float multiply.
+ */
+uint8_t write_float(char *buffer, float value, uint8_t dp)
+{
+    if (isnan(value))
+    {
+        return write_text(buffer, "nan");
+    }
+    if (isinf(value))
+    {
+        return write_text(buffer, "inf");
+    }
+    float magnitude = fabs(value);
+    if (magnitude > MAX_FLOAT)
+    {
+        return write_text(buffer, "ovf");
+    }
+    if (dp > MAX_FLOAT_DECIMAL_PLACES)
+    {
+        dp = MAX_FLOAT_DECIMAL_PLACES;
+    }
+    uint32_t scale = pgm_read_dword(powers_of_ten + 9 - dp);
+    uint32_t integer = magnitude;
+    uint32_t fraction = (magnitude - integer) * scale + 0.5f;
+    if (fraction >= scale)
+    {
+        integer++;
+        fraction -= scale;
+    }
+    char *ptr = buffer;
+    if (value < 0 and (integer != 0 or fraction != 0))
+    {
+        *ptr++ = '-';
+    }
+    ptr = write_digits(ptr, integer, 1);
+    if (dp > 0)
+    {
+        *ptr++ = '.';
+        ptr = write_digits(ptr, fraction, dp);
+    }
+    *ptr = 0;
+    return ptr - buffer;
+}
+
+uint8_t write_hex(char *buffer, uint32_t value, uint8_t digits)
+{
+    char *ptr = buffer;
+    for (int8_t shift = 28; shift >= 0; shift -= 4)
+    {
+        uint8_t nibble = (value >> shift) & 0x0F;
+        if (nibble != 0 or ptr != buffer or shift < digits * 4)
+        {
+            *ptr++ = nibble < 10 ? '0' + nibble : 'A' - 10 + nibble;
+        }
+    }
+    *ptr = 0;
+    return ptr - buffer;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void print_unsigned(Print &out, uint32_t value)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    out.write((const uint8_t *)buffer, write_unsigned(buffer, value));
+}
+
+void print_integer(Print &out, int32_t value)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    out.write((const uint8_t *)buffer, write_integer(buffer, value));
+}
+
+void print_float(Print &out, float value, uint8_t dp)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    out.write((const uint8_t *)buffer, write_float(buffer, value, dp));
+}
+
+void print_hex(Print &out, uint32_t value, uint8_t digits)
+{
+    char buffer[WRITE_NUMBER_BUFFER_SIZE];
+    out.write((const uint8_t *)buffer, write_hex(buffer, value, digits));
+}
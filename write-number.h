@@ -0,0 +1,89 @@
+/*
+ * File: write-number.cpp
+ * Project: ukmarsey
+ * File Created: Friday, 16th October 2026 10:12:05 am
+ *
+ *   ukmarsey is a machine and human command-based Robot Low-level I/O platform initially targetting UKMARSBot
+ *   For more information see:
+ *       https://github.com/robzed/ukmarsey
+ *       https://ukmars.org/
+ *       https://github.com/ukmars/ukmarsbot
+ *       https://github.com/robzed/pizero_for_ukmarsbot
+ *
+ *  MIT License
+ *
+ *  Copyright (c) 2020-2021 Rob Probin & Peter Harrison
+ *  Copyright (c) 2019-2021 UK Micromouse and Robotics Society
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+*/
+#ifndef WRITE_NUMBER_H
+#define WRITE_NUMBER_H
+
+#include <Arduino.h>
+
+/***
+ * Numeric output formatters
+ *
+ * These replace Print::print() for numbers. Print divides by the base once
+ * per digit and prints floats one digit at a time with a float multiply and
+ * subtract for each, which is slow on an AVR with no hardware divide.
+ *
+ * Here digits are found by repeated subtraction of powers of ten. A float is
+ * split into a whole number and a fraction scaled by 10^dp, and both are
+ * written as longs.
+ *
+ * Each write_ function is provided with
+ *
+ *   buffer - a character array of at least WRITE_NUMBER_BUFFER_SIZE
+ *   value  - the number to write
+ *
+ * The buffer is null terminated and the return value is the number of
+ * characters written, excluding the terminator.
+ *
+ * The print_ functions format into a local buffer and write the whole number
+ * in one go, so a number going into a full serial output lane is either sent
+ * complete or dropped complete.
+ *
+ * Differences from Print:
+ *  - a negative float that rounds to zero is written as 0.00 not -0.00
+ *  - no more than MAX_FLOAT_DECIMAL_PLACES decimal places are written
+ */
+
+// "-4294967040." plus MAX_FLOAT_DECIMAL_PLACES digits and the terminator
+#define WRITE_NUMBER_BUFFER_SIZE 21
+
+#define MAX_FLOAT_DECIMAL_PLACES 8
+
+uint8_t write_unsigned(char *buffer, uint32_t value);
+uint8_t write_integer(char *buffer, int32_t value);
+
+// value is the number multiplied by 10^dp. e.g. write_fixed(b, 7421, 3) gives 7.421
+uint8_t write_fixed(char *buffer, int32_t value, uint8_t dp);
+uint8_t write_float(char *buffer, float value, uint8_t dp);
+
+// upper case. Zero padded to at least digits characters
+uint8_t write_hex(char *buffer, uint32_t value, uint8_t digits = 1);
+
+void print_unsigned(Print &out, uint32_t value);
+void print_integer(Print &out, int32_t value);
+void print_float(Print &out, float value, uint8_t dp = 2);
+void print_hex(Print &out, uint32_t value, uint8_t digits = 1);
+
+#endif